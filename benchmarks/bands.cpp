@@ -0,0 +1,132 @@
+// Measures how drawing a 4K frame of small cells scales with the number of threads.
+//
+// Build with -DGRIDVIZ_BUILD_BENCHMARKS=ON and run `benchmark-bands`.
+
+#include <SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cz/heap.hpp>
+
+#include "render.hpp"
+#include "workers.hpp"
+
+using namespace gridviz;
+
+static const int frame_width = 3840;
+static const int frame_height = 2160;
+static const int font_width = 6;
+static const int font_height = 13;
+static const int bands_per_worker = 4;
+static const int iterations = 20;
+
+static uint32_t random_state = 12345;
+static uint32_t next_random() {
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 8;
+}
+
+/// Build a size with a random glyph for every byte without going through FreeType.
+static void make_font(Size_Cache* font, Glyph_Table* table) {
+    *font = {};
+    font->font_width = font_width;
+    font->font_height = font_height;
+
+    Glyph_Atlas* atlas = &font->atlas;
+    size_t glyph_bytes = font_width * font_height;
+    atlas->coverage.reserve_exact(cz::heap_allocator(), 256 * glyph_bytes);
+    atlas->coverage.len = 256 * glyph_bytes;
+    for (size_t i = 0; i < atlas->coverage.len; ++i) {
+        uint32_t r = next_random() % 8;
+        atlas->coverage[i] = (r < 5 ? 0 : r == 5 ? 255 : (uint8_t)next_random());
+    }
+    for (uint32_t slot = 0; slot < 256; ++slot) {
+        table->slots[slot] = slot;
+    }
+}
+
+/// Draw every row of cells that intersects the clip rectangle.
+static void draw_band(const Size_Cache* font,
+                      const Glyph_Table* table,
+                      SDL_Surface* surface,
+                      const SDL_Rect& clip,
+                      const std::vector<Cell>& cells,
+                      int columns) {
+    int first_row = clip.y / font_height;
+    int last_row = (clip.y + clip.h - 1) / font_height;
+    for (int row = first_row; row <= last_row; ++row) {
+        cz::Slice<const Cell> slice = {cells.data() + row * columns, (size_t)columns};
+        render_cell_row_shared(font, table, surface, clip, row * font_height, slice);
+    }
+}
+
+int main() {
+    if (SDL_Init(0) != 0) {
+        fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, frame_width, frame_height, 32,
+                                                          SDL_PIXELFORMAT_ARGB8888);
+    if (!surface) {
+        fprintf(stderr, "SDL_CreateRGBSurfaceWithFormat failed: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    Size_Cache font;
+    Glyph_Table table;
+    make_font(&font, &table);
+
+    int columns = frame_width / font_width;
+    int rows = (frame_height + font_height - 1) / font_height;
+    std::vector<Cell> cells(columns * rows);
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            Cell* cell = &cells[row * columns + column];
+            uint32_t fg = next_random(), bg = next_random();
+            cell->px = column * font_width;
+            cell->foreground = {(uint8_t)fg, (uint8_t)(fg >> 8), (uint8_t)(fg >> 16), 0xff};
+            cell->background = {(uint8_t)bg, (uint8_t)(bg >> 8), (uint8_t)(bg >> 16), 0xff};
+            memset(cell->seq, 0, sizeof(cell->seq));
+            cell->seq[0] = (char)(33 + next_random() % 94);
+        }
+    }
+
+    unsigned processors = std::thread::hardware_concurrency();
+    if (processors == 0)
+        processors = 1;
+
+    SDL_LockSurface(surface);
+    double single_ms = 0;
+    for (unsigned threads = 1; threads <= processors; threads *= 2) {
+        Worker_Pool* workers = start_workers(threads - 1);
+        size_t bands = (threads == 1 ? 1 : threads * bands_per_worker);
+        SDL_Rect clip = {0, 0, frame_width, frame_height};
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            run_parallel(workers, bands, [&](size_t band) {
+                int start_y = (int)(frame_height * band / bands);
+                int end_y = (int)(frame_height * (band + 1) / bands);
+                SDL_Rect band_clip = {clip.x, start_y, clip.w, end_y - start_y};
+                draw_band(&font, &table, surface, band_clip, cells, columns);
+            });
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+        if (threads == 1)
+            single_ms = ms;
+
+        printf("threads=%-3u bands=%-4zu %8.3f ms/frame  %5.2fx\n", threads, bands, ms,
+               single_ms / ms);
+        stop_workers(workers);
+    }
+    SDL_UnlockSurface(surface);
+
+    SDL_FreeSurface(surface);
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,243 @@
+// Compares the cell compositing kernels against drawing each cell with SDL the way
+// `render_code_point` used to: fill the background then blit a glyph surface rendered
+// in the foreground color.
+//
+// Build with -DGRIDVIZ_BUILD_BENCHMARKS=ON and run `benchmark-composite`.
+
+#include <SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "composite.hpp"
+
+using namespace gridviz;
+
+static const int frame_width = 1920;
+static const int frame_height = 1080;
+static const int font_width = 8;
+static const int font_height = 18;
+static const int num_glyphs = 95;
+/// Glyph surfaces were cached per foreground color so use a small palette.
+static const int num_foregrounds = 16;
+static const int iterations = 50;
+
+static uint32_t random_state = 12345;
+static uint32_t next_random() {
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 8;
+}
+
+struct Frame_Cell {
+    int glyph;
+    int foreground_index;
+    uint32_t foreground;
+    uint32_t background;
+};
+
+/// The exact result: blend every pixel of every cell with a division per channel.
+static void reference_frame(uint32_t* pixels,
+                            const uint8_t* glyphs,
+                            const std::vector<Frame_Cell>& cells,
+                            int columns,
+                            int rows) {
+    for (int cy = 0; cy < rows; ++cy) {
+        for (int cx = 0; cx < columns; ++cx) {
+            const Frame_Cell& cell = cells[cy * columns + cx];
+            const uint8_t* glyph = glyphs + cell.glyph * font_width * font_height;
+            for (int y = 0; y < font_height; ++y) {
+                uint32_t* row = pixels + (cy * font_height + y) * frame_width + cx * font_width;
+                for (int x = 0; x < font_width; ++x) {
+                    uint32_t alpha = glyph[y * font_width + x];
+                    uint32_t result = 0;
+                    for (int shift = 0; shift < 32; shift += 8) {
+                        uint32_t fg = (cell.foreground >> shift) & 0xff;
+                        uint32_t bg = (cell.background >> shift) & 0xff;
+                        result |= ((bg * (255 - alpha) + fg * alpha + 127) / 255) << shift;
+                    }
+                    row[x] = result;
+                }
+            }
+        }
+    }
+}
+
+/// Glyph surfaces like `TTF_RenderUTF8_Blended` made: the foreground color with the
+/// coverage as alpha.  Indexed by `glyph * num_foregrounds + foreground_index`.
+static std::vector<SDL_Surface*> make_glyph_surfaces(const uint8_t* glyphs,
+                                                     const uint32_t* foregrounds) {
+    std::vector<SDL_Surface*> surfaces;
+    for (int g = 0; g < num_glyphs; ++g) {
+        const uint8_t* glyph = glyphs + g * font_width * font_height;
+        for (int f = 0; f < num_foregrounds; ++f) {
+            // Surfaces with an alpha channel are blended when blitted.
+            SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(
+                0, font_width, font_height, 32, SDL_PIXELFORMAT_ARGB8888);
+            for (int y = 0; y < font_height; ++y) {
+                uint32_t* row = (uint32_t*)((uint8_t*)surface->pixels + y * surface->pitch);
+                for (int x = 0; x < font_width; ++x) {
+                    row[x] = ((uint32_t)glyph[y * font_width + x] << 24) |
+                             (foregrounds[f] & 0xffffff);
+                }
+            }
+            surfaces.push_back(surface);
+        }
+    }
+    return surfaces;
+}
+
+/// The old path: fill each cell's background then blit its glyph over it.
+static void sdl_frame(SDL_Surface* window,
+                      const std::vector<SDL_Surface*>& surfaces,
+                      const std::vector<Frame_Cell>& cells,
+                      int columns,
+                      int rows) {
+    for (int cy = 0; cy < rows; ++cy) {
+        for (int cx = 0; cx < columns; ++cx) {
+            const Frame_Cell& cell = cells[cy * columns + cx];
+            SDL_Rect rect = {cx * font_width, cy * font_height, font_width, font_height};
+            uint32_t background = cell.background;
+            SDL_FillRect(window, &rect,
+                         SDL_MapRGB(window->format, (uint8_t)(background >> 16),
+                                    (uint8_t)(background >> 8), (uint8_t)background));
+
+            SDL_Surface* glyph = surfaces[cell.glyph * num_foregrounds + cell.foreground_index];
+            SDL_Rect source = {0, 0, font_width, font_height};
+            SDL_BlitSurface(glyph, &source, window, &rect);
+        }
+    }
+}
+
+/// Largest difference in any color channel between two frames.
+static int max_difference(const uint32_t* left, const uint32_t* right, size_t count) {
+    int result = 0;
+    for (size_t i = 0; i < count; ++i) {
+        for (int shift = 0; shift < 24; shift += 8) {
+            int l = (left[i] >> shift) & 0xff;
+            int r = (right[i] >> shift) & 0xff;
+            int difference = (l > r ? l - r : r - l);
+            if (difference > result)
+                result = difference;
+        }
+    }
+    return result;
+}
+
+/// The new path: build each row of cells then composite it one row of pixels at a time.
+static void kernel_frame(uint32_t* pixels,
+                         const uint8_t* glyphs,
+                         const std::vector<Frame_Cell>& cells,
+                         int columns,
+                         int rows) {
+    std::vector<Composite_Cell> row_cells(columns);
+    for (int cy = 0; cy < rows; ++cy) {
+        for (int cx = 0; cx < columns; ++cx) {
+            const Frame_Cell& cell = cells[cy * columns + cx];
+            Composite_Cell* out = &row_cells[cx];
+            out->coverage = glyphs + cell.glyph * font_width * font_height;
+            out->foreground = cell.foreground;
+            out->background = cell.background;
+            out->x = cx * font_width;
+            out->width = font_width;
+        }
+        for (int y = 0; y < font_height; ++y) {
+            uint32_t* row = pixels + (cy * font_height + y) * frame_width;
+            composite_row(row, row_cells.data(), columns, y * font_width);
+        }
+    }
+}
+
+template <class Func>
+static double time_frames(Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        func();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+int main() {
+    int columns = frame_width / font_width;
+    int rows = frame_height / font_height;
+
+    // Glyph-like coverage: mostly empty with solid strokes and antialiased edges.
+    std::vector<uint8_t> glyphs(num_glyphs * font_width * font_height);
+    for (size_t i = 0; i < glyphs.size(); ++i) {
+        uint32_t r = next_random() % 8;
+        glyphs[i] = (r < 5 ? 0 : r == 5 ? 255 : (uint8_t)next_random());
+    }
+
+    uint32_t foregrounds[num_foregrounds];
+    for (int f = 0; f < num_foregrounds; ++f) {
+        foregrounds[f] = next_random() | 0xff000000;
+    }
+
+    std::vector<Frame_Cell> cells(columns * rows);
+    for (size_t i = 0; i < cells.size(); ++i) {
+        cells[i].glyph = next_random() % num_glyphs;
+        cells[i].foreground_index = next_random() % num_foregrounds;
+        cells[i].foreground = foregrounds[cells[i].foreground_index];
+        cells[i].background = next_random() | 0xff000000;
+    }
+
+    std::vector<uint32_t> expected(frame_width * frame_height);
+    std::vector<uint32_t> actual(frame_width * frame_height);
+    reference_frame(expected.data(), glyphs.data(), cells, columns, rows);
+
+    // Window surfaces are usually 32 bit without alpha.
+    std::vector<SDL_Surface*> surfaces = make_glyph_surfaces(glyphs.data(), foregrounds);
+    SDL_Surface* window =
+        SDL_CreateRGBSurfaceWithFormat(0, frame_width, frame_height, 32, SDL_PIXELFORMAT_RGB888);
+    if (!window) {
+        fprintf(stderr, "SDL_CreateRGBSurfaceWithFormat failed: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    double sdl_ms = time_frames([&]() { sdl_frame(window, surfaces, cells, columns, rows); });
+    for (int y = 0; y < frame_height; ++y) {
+        memcpy(&actual[y * frame_width], (uint8_t*)window->pixels + y * window->pitch,
+               frame_width * sizeof(uint32_t));
+    }
+    printf("%-10s %8.3f ms/frame  max difference=%d\n", "sdl", sdl_ms,
+           max_difference(actual.data(), expected.data(), actual.size()));
+
+    SDL_FreeSurface(window);
+    for (size_t i = 0; i < surfaces.size(); ++i) {
+        SDL_FreeSurface(surfaces[i]);
+    }
+
+    const char* names[] = {"scalar", "sse2", "avx2"};
+    Composite_Kernel kernels[] = {COMPOSITE_SCALAR, COMPOSITE_SSE2, COMPOSITE_AVX2};
+    int status = 0;
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+        if (!set_composite_kernel(kernels[k])) {
+            printf("%-10s unsupported\n", names[k]);
+            continue;
+        }
+
+        memset(actual.data(), 0, actual.size() * sizeof(uint32_t));
+        double ms = time_frames(
+            [&]() { kernel_frame(actual.data(), glyphs.data(), cells, columns, rows); });
+
+        // Rounding differs from the exact result by at most one per channel.
+        size_t mismatches = 0;
+        for (size_t i = 0; i < actual.size(); ++i) {
+            for (int shift = 0; shift < 32; shift += 8) {
+                int left = (actual[i] >> shift) & 0xff;
+                int right = (expected[i] >> shift) & 0xff;
+                if (left - right > 1 || right - left > 1)
+                    ++mismatches;
+            }
+        }
+        if (mismatches > 0)
+            status = 1;
+
+        printf("%-10s %8.3f ms/frame  %5.2fx  mismatches=%zu\n", names[k], ms, sdl_ms / ms,
+               mismatches);
+    }
+
+    return status;
+}
@@ -0,0 +1,97 @@
+// Measures how the time to parse a burst of messages scales with the size of the burst.
+// The time per event should stay flat as bursts grow.
+//
+// Build with -DGRIDVIZ_BUILD_BENCHMARKS=ON and run `benchmark-ingest`.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#define NETGRIDVIZ_DEFINE_PROTOCOL
+#include "../netgridviz.h"
+
+#include "server.hpp"
+
+using namespace gridviz;
+
+static const size_t min_events = 1 << 10;
+static const size_t max_events = 1 << 22;
+static const size_t events_per_stroke = 64;
+static const size_t events_per_color = 256;
+static const int columns = 80;
+static const int iterations = 5;
+
+static void push_bytes(std::vector<char>* out, const void* bytes, size_t len) {
+    out->insert(out->end(), (const char*)bytes, (const char*)bytes + len);
+}
+
+/// Untitled strokes of `events_per_stroke` cells drawn across rows of `columns`
+/// with the foreground changing every `events_per_color` cells.
+static std::vector<char> make_burst(size_t events, bool compact) {
+    std::vector<char> burst;
+    uint16_t context_id = 0;
+    for (size_t i = 0; i < events; ++i) {
+        if (i % events_per_stroke == 0) {
+            uint8_t message[5] = {GRIDVIZ_START_STROKE};
+            push_bytes(&burst, message, sizeof(message));
+        }
+        if (i % events_per_color == 0) {
+            uint8_t message[6] = {GRIDVIZ_SET_FG};
+            memcpy(message + 1, &context_id, sizeof(context_id));
+            message[3] = (uint8_t)(i / events_per_color);
+            message[4] = 128;
+            message[5] = 255;
+            push_bytes(&burst, message, sizeof(message));
+        }
+
+        int64_t x = (int64_t)(i % columns);
+        int64_t y = (int64_t)(i / columns);
+        char ch = (char)('a' + i % 26);
+        if (compact && x != 0) {
+            uint8_t message[2] = {GRIDVIZ_COMPACT_CHAR | GRIDVIZ_COMPACT_SAME_CONTEXT |
+                                  GRIDVIZ_COMPACT_NEXT_CELL};
+            memcpy(message + 1, &ch, sizeof(ch));
+            push_bytes(&burst, message, sizeof(message));
+        } else {
+            uint8_t message[20] = {GRIDVIZ_SEND_CHAR};
+            memcpy(message + 1, &context_id, sizeof(context_id));
+            memcpy(message + 3, &x, sizeof(x));
+            memcpy(message + 11, &y, sizeof(y));
+            memcpy(message + 19, &ch, sizeof(ch));
+            push_bytes(&burst, message, sizeof(message));
+        }
+    }
+    return burst;
+}
+
+/// Best time over `iterations` runs in nanoseconds per event.
+static double time_burst(const std::vector<char>& burst, size_t events) {
+    double best = 0;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        bool ok = parse_burst({burst.data(), burst.size()});
+        auto end = std::chrono::steady_clock::now();
+        if (!ok) {
+            fprintf(stderr, "Burst of %zu events was rejected\n", events);
+            return 0;
+        }
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (i == 0 || ns < best)
+            best = ns;
+    }
+    return best / events;
+}
+
+int main() {
+    printf("%10s %10s %18s\n", "events", "ns/event", "compact ns/event");
+    for (size_t events = min_events; events <= max_events; events *= 4) {
+        std::vector<char> plain = make_burst(events, false);
+        std::vector<char> compact = make_burst(events, true);
+        double plain_ns = time_burst(plain, events);
+        double compact_ns = time_burst(compact, events);
+        printf("%10zu %10.1f %18.1f\n", events, plain_ns, compact_ns);
+    }
+    return 0;
+}
@@ -48,5 +48,10 @@ int main() {
         }
     }
 
+    // Send the final state of the grid in one command.
+    netgridviz_start_stroke("Final grid");
+    netgridviz_draw_grid(&normal, 0, 0, 10, 10, sizeof(grid[0]), &grid[0][0]);
+    netgridviz_end_stroke();
+
     netgridviz_disconnect();
 }
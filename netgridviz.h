@@ -1,6 +1,8 @@
 #ifndef NETGRIDVIZ_HEADER_GUARD
 #define NETGRIDVIZ_HEADER_GUARD
 
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /// This is an all in one header file for netgridviz.
@@ -24,6 +26,13 @@ typedef struct netgridviz_context {
 } netgridviz_context;
 
 #define NETGRIDVIZ_DEFAULT_PORT 41088
+#define NETGRIDVIZ_DEFAULT_BUFFER_SIZE 65536
+#define NETGRIDVIZ_DEFAULT_RING_SIZE (1 << 22)
+
+/// Ways of connecting to the server.  See `netgridviz_set_transport`.
+#define NETGRIDVIZ_TRANSPORT_TCP 0
+#define NETGRIDVIZ_TRANSPORT_UNIX 1
+#define NETGRIDVIZ_TRANSPORT_SHARED_MEMORY 2
 
 /////////////////////////////////////////////////
 // Connection
@@ -31,9 +40,34 @@ typedef struct netgridviz_context {
 
 /// Connect on the given port to the server.  Returns `0` on success, `-1` on failure.
 int netgridviz_connect(int port);
-/// Disconnect from the server.
+/// Disconnect from the server.  Flushes any buffered commands first.
 void netgridviz_disconnect(void);
 
+/// Set the size of the send buffer.  Commands are accumulated in the send buffer
+/// and are sent when it fills up, when a stroke ends, or when `netgridviz_flush`
+/// is called.  A size of `0` sends every command immediately.  Defaults to
+/// `NETGRIDVIZ_DEFAULT_BUFFER_SIZE`.
+void netgridviz_set_buffer_size(size_t size);
+
+/// Send all buffered commands to the server.
+void netgridviz_flush(void);
+
+/// Request the compact wire encoding when connecting.  The compact encoding
+/// sends coordinates as deltas from the previous cell drawn with the same
+/// context, so drawing cells in scan order costs about two bytes per cell.
+/// It is only used if the server supports it.  Enabled by default.
+void netgridviz_set_compact_encoding(int enabled);
+
+/// Choose how `netgridviz_connect` connects to the server.  Must be called before connecting.
+///
+/// * `NETGRIDVIZ_TRANSPORT_TCP` connects over loopback TCP.  This is the default.
+/// * `NETGRIDVIZ_TRANSPORT_UNIX` connects over a Unix domain socket.  Not supported on Windows.
+/// * `NETGRIDVIZ_TRANSPORT_SHARED_MEMORY` connects over a Unix domain socket and then sends
+///   commands through a ring buffer shared with the server.  Sending only makes a syscall
+///   when the server is asleep or the ring is full.  Falls back to the Unix domain socket
+///   if the server doesn't accept the ring.  Only supported on Linux.
+void netgridviz_set_transport(int transport);
+
 /////////////////////////////////////////////////
 // Context
 /////////////////////////////////////////////////
@@ -42,7 +76,8 @@ void netgridviz_disconnect(void);
 /// context is only used to store foreground and background color data.
 netgridviz_context netgridviz_create_context(void);
 
-/// Set colors.
+/// Set colors.  Colors are sent lazily when the context is next drawn with so
+/// changing the color multiple times between draws is cheap.
 void netgridviz_set_fg(netgridviz_context* context, uint8_t r, uint8_t g, uint8_t b);
 void netgridviz_set_bg(netgridviz_context* context, uint8_t r, uint8_t g, uint8_t b);
 
@@ -58,12 +93,13 @@ void netgridviz_set_bg(netgridviz_context* context, uint8_t r, uint8_t g, uint8_
 void netgridviz_start_stroke(const char* title);
 
 /// End a stroke.  Note: starting a new stroke will automatically end the previous stroke.
+/// Ending a stroke flushes the send buffer so the server displays it immediately.
 void netgridviz_end_stroke(void);
 
 /// Draw a character.
 void netgridviz_draw_char(netgridviz_context* context, int64_t x, int64_t y, char ch);
 
-/// Draw a string.
+/// Draw a string.  Characters are drawn left to right starting at `(x, y)`.
 void netgridviz_draw_string(netgridviz_context* context, int64_t x, int64_t y, const char* string);
 void netgridviz_draw_fmt(netgridviz_context* context,
                          int64_t x,
@@ -76,6 +112,30 @@ void netgridviz_draw_vfmt(netgridviz_context* context,
                           const char* format,
                           va_list args);
 
+/// Draw a `width` by `height` block of characters with its top left corner at `(x, y)`.
+/// Row `r` of the block starts at `data + r * stride`.  This is much
+/// cheaper than drawing each character individually.
+void netgridviz_draw_grid(netgridviz_context* context,
+                          int64_t x,
+                          int64_t y,
+                          uint32_t width,
+                          uint32_t height,
+                          size_t stride,
+                          const char* data);
+
+/// Draw a block of characters with per cell colors.  `fg` and `bg` are arrays
+/// of `width * height` RGB triples in row major order.  Either may be null in
+/// which case the context's color is used for every cell.
+void netgridviz_draw_grid_colored(netgridviz_context* context,
+                                  int64_t x,
+                                  int64_t y,
+                                  uint32_t width,
+                                  uint32_t height,
+                                  size_t stride,
+                                  const char* data,
+                                  const uint8_t* fg,
+                                  const uint8_t* bg);
+
 #endif  // NETGRIDVIZ_HEADER_GUARD
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -87,8 +147,55 @@ void netgridviz_draw_vfmt(netgridviz_context* context,
 #define GRIDVIZ_SET_BG 2
 #define GRIDVIZ_START_STROKE 3
 #define GRIDVIZ_SEND_CHAR 4
+#define GRIDVIZ_SEND_STRING 5
+#define GRIDVIZ_SEND_GRID 6
+
+#define GRIDVIZ_HELLO 7
+
+/// Flags for `GRIDVIZ_SEND_GRID`.
+#define GRIDVIZ_GRID_HAS_FG 1
+#define GRIDVIZ_GRID_HAS_BG 2
+
+/// Features negotiated by `GRIDVIZ_HELLO`.  The client sends the features it
+/// wants and the server responds with `GRIDVIZ_HELLO` and the features it accepts.
+#define GRIDVIZ_FEATURE_COMPACT 1
+/// The `GRIDVIZ_HELLO` message is sent over a Unix domain socket with two file descriptors
+/// attached: a memfd containing a `gridviz_ring_header` followed by the ring's data and an
+/// eventfd used to wake the server.  The memfd must be sealed with `F_SEAL_SHRINK`.  If
+/// accepted then all further messages go through the ring.
+#define GRIDVIZ_FEATURE_SHARED_MEMORY 2
+
+/// Path of the Unix domain socket.  Formatted with the port number.
+#define GRIDVIZ_UNIX_SOCKET_FORMAT "/tmp/gridviz-%d.sock"
+
+/// Header of the shared memory ring buffer.  `head` and `tail` increase forever and are taken
+/// modulo `capacity` to get an offset into the data.  `head` is written by the server and `tail`
+/// by the client.  The server sets `consumer_waiting` before it goes to sleep.  The client
+/// must signal the eventfd after writing if `consumer_waiting` is set.
+typedef struct gridviz_ring_header {
+    uint64_t capacity;  // Power of two.
+    uint32_t consumer_waiting;
+    uint8_t padding0[52];
+    uint64_t head;
+    uint8_t padding1[56];
+    uint64_t tail;
+    uint8_t padding2[56];
+} gridviz_ring_header;
+
+/// Compact char messages have the high bit of the type set.  The
+/// rest of the type byte is flags describing what fields follow:
+///
+/// * If `GRIDVIZ_COMPACT_SAME_CONTEXT` is not set then the context id follows as a varint.
+/// * If `GRIDVIZ_COMPACT_NEXT_CELL` is set then the cell is to the right of the previous
+///   cell drawn with the context.  Otherwise the x and y deltas from the previous cell
+///   follow as zigzag encoded varints.
+///
+/// The character is the last byte of the message.
+#define GRIDVIZ_COMPACT_CHAR 0x80
+#define GRIDVIZ_COMPACT_SAME_CONTEXT 0x40
+#define GRIDVIZ_COMPACT_NEXT_CELL 0x20
 
-static netgridviz_context netgridviz_make_context(uint16_t id) {
+static inline netgridviz_context netgridviz_make_context(uint16_t id) {
     netgridviz_context context = {id};
     // White foreground.
     context.fg[0] = 0x00;
@@ -106,7 +213,7 @@ static netgridviz_context netgridviz_make_context(uint16_t id) {
 
 #include <stdio.h>   // print error on lose connection
 #include <stdlib.h>  // malloc
-#include <string.h>  // strlen
+#include <string.h>  // strlen, memcpy
 
 ///////////////////////////////////////////////////////////////////////////////
 // Module Code - connection
@@ -131,9 +238,27 @@ static netgridviz_context netgridviz_make_context(uint16_t id) {
 #include <netinet/ip.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Older C libraries don't define the memfd sealing constants.
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+#endif
+
 #ifdef _WIN32
 #define ssize_t int
 #define socklen_t int
@@ -152,6 +277,26 @@ static netgridviz_context netgridviz_make_context(uint16_t id) {
 
 static SOCKET netgridviz_socket = INVALID_SOCKET;
 
+/// Commands are buffered here to avoid doing a syscall per command.
+static uint8_t* netgridviz_buffer;
+static size_t netgridviz_buffer_len;
+static size_t netgridviz_buffer_cap = NETGRIDVIZ_DEFAULT_BUFFER_SIZE;
+
+/// Note: using `uint8_t` instead of `bool` so C compliant.
+static uint8_t netgridviz_want_compact = 1;
+static uint8_t netgridviz_compact;
+
+static int netgridviz_transport = NETGRIDVIZ_TRANSPORT_TCP;
+
+#ifdef __linux__
+/// The shared memory ring.  Only used if the server accepted `GRIDVIZ_FEATURE_SHARED_MEMORY`.
+static uint8_t netgridviz_shared_memory;
+static gridviz_ring_header* netgridviz_ring;
+static size_t netgridviz_ring_size;
+static int netgridviz_ring_memfd = -1;
+static int netgridviz_ring_eventfd = -1;
+#endif
+
 #ifdef _WIN32
 /// Winsock requires a global variable to store state.
 static WSADATA netgridviz_winsock_global;
@@ -166,10 +311,24 @@ static int netgridviz_winsock_end(void);
 static int netgridviz_make_non_blocking(SOCKET sock);
 
 static int netgridviz_client_connect_sock(SOCKET sock, int port);
+#ifndef _WIN32
+static int netgridviz_client_connect_unix(SOCKET sock, int port);
+#endif
+#ifdef __linux__
+static int netgridviz_create_ring(void);
+static void netgridviz_destroy_ring(void);
+static int netgridviz_ring_write(const void* buffer, size_t len);
+#endif
 static int netgridviz_connect_timeout(SOCKET sock,
                                       const struct sockaddr* addr,
                                       socklen_t len,
                                       struct timeval* timeout);
+static int netgridviz_send_all(const void* buffer, size_t len);
+static void netgridviz_alloc_buffer(void);
+static void netgridviz_lose_connection(void);
+static int netgridviz_negotiate(void);
+static int netgridviz_send_hello(uint32_t features);
+static void netgridviz_reset_context_states(void);
 
 /////////////////////////////////////////////////
 // Module Code - connect to server
@@ -180,13 +339,30 @@ int netgridviz_connect(int port) {
     if (result != 0)
         return -1;
 
-    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    int family = AF_INET;
+    if (netgridviz_transport != NETGRIDVIZ_TRANSPORT_TCP) {
+#ifdef _WIN32
+        netgridviz_winsock_end();
+        return -1;
+#else
+        family = AF_UNIX;
+#endif
+    }
+
+    SOCKET sock = socket(family, SOCK_STREAM, 0);
     if (sock == INVALID_SOCKET) {
         netgridviz_winsock_end();
         return -1;
     }
 
+#ifdef _WIN32
     result = netgridviz_client_connect_sock(sock, port);
+#else
+    if (family == AF_UNIX)
+        result = netgridviz_client_connect_unix(sock, port);
+    else
+        result = netgridviz_client_connect_sock(sock, port);
+#endif
 
     if (result < 0) {
         closesocket(sock);
@@ -195,10 +371,136 @@ int netgridviz_connect(int port) {
     }
 
     netgridviz_socket = sock;
+    netgridviz_reset_context_states();
+
+    result = netgridviz_negotiate();
+    if (result < 0) {
+#ifdef __linux__
+        netgridviz_destroy_ring();
+#endif
+        closesocket(sock);
+        netgridviz_socket = INVALID_SOCKET;
+        netgridviz_winsock_end();
+        return -1;
+    }
+
+    netgridviz_alloc_buffer();
 
     return 0;
 }
 
+/////////////////////////////////////////////////
+// Module Code - negotiate features with the server
+/////////////////////////////////////////////////
+
+void netgridviz_set_compact_encoding(int enabled) {
+    netgridviz_want_compact = (enabled != 0);
+}
+
+void netgridviz_set_transport(int transport) {
+    netgridviz_transport = transport;
+}
+
+static int netgridviz_negotiate(void) {
+    netgridviz_compact = 0;
+
+    uint32_t features = 0;
+    if (netgridviz_want_compact)
+        features |= GRIDVIZ_FEATURE_COMPACT;
+#ifdef __linux__
+    // If creating the ring fails then fallback to the Unix domain socket.
+    if (netgridviz_transport == NETGRIDVIZ_TRANSPORT_SHARED_MEMORY && netgridviz_create_ring() == 0)
+        features |= GRIDVIZ_FEATURE_SHARED_MEMORY;
+#endif
+    if (features == 0)
+        return 0;
+
+    if (netgridviz_send_hello(features) < 0)
+        return -1;
+
+    // Wait for the server to tell us which features it accepts.
+    uint8_t response[5];
+    size_t received = 0;
+    while (received < sizeof(response)) {
+        fd_set set_read;
+        FD_ZERO(&set_read);
+        FD_SET(netgridviz_socket, &set_read);
+
+        struct timeval timeout = {0};
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        int result = select((int)(netgridviz_socket + 1), &set_read, NULL, NULL, &timeout);
+        if (result <= 0)
+            return -1;
+
+        ssize_t count = recv(netgridviz_socket, (char*)response + received,
+                             (len_t)(sizeof(response) - received), 0);
+        if (count <= 0)
+            return -1;
+        received += (size_t)count;
+    }
+
+    if (response[0] != GRIDVIZ_HELLO)
+        return -1;
+
+    uint32_t accepted;
+    memcpy(&accepted, response + 1, sizeof(accepted));
+    netgridviz_compact = ((accepted & GRIDVIZ_FEATURE_COMPACT) != 0);
+
+#ifdef __linux__
+    // The server has its own copy of the memfd so we only need to keep the mapping.
+    if (netgridviz_ring_memfd != -1) {
+        close(netgridviz_ring_memfd);
+        netgridviz_ring_memfd = -1;
+    }
+    if (accepted & GRIDVIZ_FEATURE_SHARED_MEMORY)
+        netgridviz_shared_memory = 1;
+    else
+        netgridviz_destroy_ring();
+#endif
+    return 0;
+}
+
+static int netgridviz_send_hello(uint32_t features) {
+    uint8_t message[5] = {GRIDVIZ_HELLO};
+    memcpy(message + 1, &features, sizeof(features));
+
+#ifdef __linux__
+    if (features & GRIDVIZ_FEATURE_SHARED_MEMORY) {
+        // Attach the memfd and eventfd to the message.
+        int fds[2] = {netgridviz_ring_memfd, netgridviz_ring_eventfd};
+        union {
+            struct cmsghdr header;
+            char buffer[CMSG_SPACE(sizeof(fds))];
+        } control;
+        memset(&control, 0, sizeof(control));
+
+        struct iovec iov;
+        iov.iov_base = &message[0];
+        iov.iov_len = sizeof(message);
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        // The socket was just connected so the message fits in the socket buffer.
+        ssize_t sent = sendmsg(netgridviz_socket, &msg, 0);
+        return (sent == (ssize_t)sizeof(message) ? 0 : -1);
+    }
+#endif
+
+    return netgridviz_send_all(&message[0], sizeof(message));
+}
+
 /////////////////////////////////////////////////
 // Module Code - disconnect from server
 /////////////////////////////////////////////////
@@ -207,8 +509,58 @@ void netgridviz_disconnect(void) {
     if (netgridviz_socket == INVALID_SOCKET)
         return;
 
+    netgridviz_flush();
+
+    // Flushing can lose the connection in which case we are already disconnected.
+    if (netgridviz_socket == INVALID_SOCKET)
+        return;
+
+#ifdef __linux__
+    // The server drains the ring when it sees the socket close.
+    netgridviz_destroy_ring();
+#endif
+
     closesocket(netgridviz_socket);
+    netgridviz_socket = INVALID_SOCKET;
     netgridviz_winsock_end();
+
+    free(netgridviz_buffer);
+    netgridviz_buffer = NULL;
+    netgridviz_buffer_len = 0;
+}
+
+/////////////////////////////////////////////////
+// Module Code - send buffer
+/////////////////////////////////////////////////
+
+static void netgridviz_alloc_buffer(void) {
+    free(netgridviz_buffer);
+    netgridviz_buffer = NULL;
+    netgridviz_buffer_len = 0;
+
+    // If allocating the buffer fails then fallback to sending each command immediately.
+    if (netgridviz_buffer_cap > 0) {
+        netgridviz_buffer = (uint8_t*)malloc(netgridviz_buffer_cap);
+        if (!netgridviz_buffer)
+            netgridviz_buffer_cap = 0;
+    }
+}
+
+void netgridviz_set_buffer_size(size_t size) {
+    netgridviz_flush();
+    netgridviz_buffer_cap = size;
+    if (netgridviz_socket != INVALID_SOCKET)
+        netgridviz_alloc_buffer();
+}
+
+void netgridviz_flush(void) {
+    if (netgridviz_socket == INVALID_SOCKET || netgridviz_buffer_len == 0)
+        return;
+
+    size_t len = netgridviz_buffer_len;
+    netgridviz_buffer_len = 0;
+    if (netgridviz_send_all(netgridviz_buffer, len) < 0)
+        netgridviz_lose_connection();
 }
 
 /////////////////////////////////////////////////
@@ -237,6 +589,29 @@ static int netgridviz_client_connect_sock(SOCKET sock, int port) {
     return 0;
 }
 
+#ifndef _WIN32
+static int netgridviz_client_connect_unix(SOCKET sock, int port) {
+    int result = netgridviz_make_non_blocking(sock);
+    if (result == SOCKET_ERROR)
+        return -1;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), GRIDVIZ_UNIX_SOCKET_FORMAT, port);
+
+    struct timeval timeout = {0};
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 500000;
+    result =
+        netgridviz_connect_timeout(sock, (struct sockaddr*)&address, sizeof(address), &timeout);
+    if (result == SOCKET_ERROR)
+        return -1;
+
+    return 0;
+}
+#endif
+
 /////////////////////////////////////////////////
 // Module Code - connect syscall with timeout
 /////////////////////////////////////////////////
@@ -254,8 +629,9 @@ static int netgridviz_connect_timeout(SOCKET sock,
     if (error != WSAEWOULDBLOCK)
         return -1;
 #else
+    // Unix domain sockets return `EAGAIN` if the server's backlog is full.
     int error = errno;
-    if (error != EINPROGRESS)
+    if (error != EINPROGRESS && error != EAGAIN)
         return -1;
 #endif
 
@@ -278,6 +654,154 @@ static int netgridviz_connect_timeout(SOCKET sock,
     return 0;
 }
 
+/////////////////////////////////////////////////
+// Module Code - send the entire buffer
+/////////////////////////////////////////////////
+
+static int netgridviz_send_all(const void* buffer, size_t len) {
+#ifdef __linux__
+    if (netgridviz_shared_memory)
+        return netgridviz_ring_write(buffer, len);
+#endif
+
+    const char* ptr = (const char*)buffer;
+    while (len > 0) {
+        ssize_t sent = send(netgridviz_socket, ptr, (len_t)len, 0);
+        if (sent > 0) {
+            ptr += sent;
+            len -= (size_t)sent;
+            continue;
+        }
+
+#ifdef _WIN32
+        if (sent == 0 || WSAGetLastError() != WSAEWOULDBLOCK)
+            return -1;
+#else
+        if (sent == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            return -1;
+#endif
+
+        // The socket is non blocking so wait for the server to catch up.
+        fd_set set_write;
+        FD_ZERO(&set_write);
+        FD_SET(netgridviz_socket, &set_write);
+
+        struct timeval timeout = {0};
+        timeout.tv_sec = 5;
+        timeout.tv_usec = 0;
+        int result = select((int)(netgridviz_socket + 1), NULL, &set_write, NULL, &timeout);
+        if (result <= 0)
+            return -1;
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////
+// Module Code - shared memory ring
+/////////////////////////////////////////////////
+
+#ifdef __linux__
+static int netgridviz_create_ring(void) {
+    size_t capacity = NETGRIDVIZ_DEFAULT_RING_SIZE;
+    netgridviz_ring_size = sizeof(gridviz_ring_header) + capacity;
+
+    netgridviz_ring_memfd =
+        (int)syscall(SYS_memfd_create, "netgridviz", MFD_ALLOW_SEALING);
+    if (netgridviz_ring_memfd < 0)
+        goto error;
+    if (ftruncate(netgridviz_ring_memfd, (off_t)netgridviz_ring_size) < 0)
+        goto error;
+    // The server only maps rings that can't be shrunk out from under it.
+    if (fcntl(netgridviz_ring_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+        goto error;
+
+    netgridviz_ring_eventfd = eventfd(0, EFD_NONBLOCK);
+    if (netgridviz_ring_eventfd < 0)
+        goto error;
+
+    {
+        void* memory = mmap(NULL, netgridviz_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            netgridviz_ring_memfd, 0);
+        if (memory == MAP_FAILED)
+            goto error;
+
+        // The memfd starts zeroed.
+        netgridviz_ring = (gridviz_ring_header*)memory;
+        netgridviz_ring->capacity = capacity;
+        netgridviz_ring->consumer_waiting = 1;
+    }
+    return 0;
+
+error:
+    netgridviz_destroy_ring();
+    return -1;
+}
+
+static void netgridviz_destroy_ring(void) {
+    netgridviz_shared_memory = 0;
+    if (netgridviz_ring) {
+        munmap(netgridviz_ring, netgridviz_ring_size);
+        netgridviz_ring = NULL;
+    }
+    if (netgridviz_ring_memfd != -1) {
+        close(netgridviz_ring_memfd);
+        netgridviz_ring_memfd = -1;
+    }
+    if (netgridviz_ring_eventfd != -1) {
+        close(netgridviz_ring_eventfd);
+        netgridviz_ring_eventfd = -1;
+    }
+}
+
+/// Copy the buffer into the ring.  Waits for the server if the ring is full.
+static int netgridviz_ring_write(const void* buffer, size_t len) {
+    gridviz_ring_header* ring = netgridviz_ring;
+    uint8_t* data = (uint8_t*)(ring + 1);
+    const uint8_t* ptr = (const uint8_t*)buffer;
+    uint64_t capacity = ring->capacity;
+    uint64_t tail = ring->tail;
+
+    // Give up if the server doesn't make progress in 5 seconds.
+    int waits = 0;
+    while (len > 0) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t space = capacity - (tail - head);
+        if (space == 0) {
+            if (++waits > 100000)
+                return -1;
+
+            // The server is awake since we signaled it when we last wrote.
+            struct timeval timeout = {0};
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 50;
+            select(0, NULL, NULL, NULL, &timeout);
+            continue;
+        }
+        waits = 0;
+
+        size_t count = (len < space ? len : (size_t)space);
+        size_t offset = (size_t)(tail & (capacity - 1));
+        size_t first = (count < capacity - offset ? count : (size_t)(capacity - offset));
+        memcpy(data + offset, ptr, first);
+        memcpy(data, ptr + first, count - first);
+
+        ptr += count;
+        len -= count;
+        tail += count;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        // Pairs with the server setting `consumer_waiting` and then rechecking `tail`.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_RELAXED)) {
+            uint64_t one = 1;
+            if (write(netgridviz_ring_eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
 /////////////////////////////////////////////////
 // Module Code - connect utility
 /////////////////////////////////////////////////
@@ -316,58 +840,192 @@ static int netgridviz_make_non_blocking(SOCKET socket) {
 // Module Code - Utility
 ///////////////////////////////////////////////////////////////////////////////
 
-static ssize_t netgridviz_send_raw(const void* buffer, size_t len) {
-    return send(netgridviz_socket, (const char*)buffer, (len_t)len, 0);
+/// Append a message to the send buffer.  Flushes the buffer if it is full.
+/// Returns `0` on success, `-1` on failure.
+static int netgridviz_send_raw(const void* buffer, size_t len) {
+    if (netgridviz_buffer_len + len > netgridviz_buffer_cap) {
+        size_t buffer_len = netgridviz_buffer_len;
+        netgridviz_buffer_len = 0;
+        if (netgridviz_send_all(netgridviz_buffer, buffer_len) < 0)
+            return -1;
+
+        // Messages that don't fit in the buffer are sent directly.
+        if (len > netgridviz_buffer_cap)
+            return netgridviz_send_all(buffer, len);
+    }
+
+    memcpy(netgridviz_buffer + netgridviz_buffer_len, buffer, len);
+    netgridviz_buffer_len += len;
+    return 0;
 }
 
 static void netgridviz_lose_connection(void) {
     fprintf(stderr, "netgridviz: Connection to server lost\n");
+
+    // Drop buffered commands since they can't be sent.
+    netgridviz_buffer_len = 0;
     netgridviz_disconnect();
-    netgridviz_socket = INVALID_SOCKET;
 }
 
 /////////////////////////////////////////////////
 // Module Code - Context
 /////////////////////////////////////////////////
 
+/// What the server thinks the state of each context is.  Indexed by context id.
+typedef struct netgridviz_context_state {
+    uint8_t fg[3];
+    uint8_t bg[3];
+    /// Position of the previous cell drawn via the compact encoding.
+    int64_t x, y;
+} netgridviz_context_state;
+
 static uint16_t netgridviz_context_counter;
+static netgridviz_context_state* netgridviz_context_states;
+static size_t netgridviz_context_states_len;
+
+/// The context used by the previous compact message.
+static uint16_t netgridviz_last_context_id;
+
+static void netgridviz_reset_context_state(uint16_t id) {
+    netgridviz_context initial = netgridviz_make_context(id);
+    netgridviz_context_state* state = &netgridviz_context_states[id];
+    memcpy(state->fg, initial.fg, sizeof(initial.fg));
+    memcpy(state->bg, initial.bg, sizeof(initial.bg));
+    state->x = 0;
+    state->y = 0;
+}
+
+static void netgridviz_reset_context_states(void) {
+    for (size_t id = 0; id < netgridviz_context_states_len; ++id) {
+        netgridviz_reset_context_state((uint16_t)id);
+    }
+    netgridviz_last_context_id = 0;
+}
+
+/// Returns null if allocation failed in which case everything is sent uncompressed.
+static netgridviz_context_state* netgridviz_get_context_state(uint16_t id) {
+    if (id < netgridviz_context_states_len)
+        return &netgridviz_context_states[id];
+    return NULL;
+}
 
 netgridviz_context netgridviz_create_context(void) {
     netgridviz_context_counter++;
-    return netgridviz_make_context(netgridviz_context_counter);
+    uint16_t id = netgridviz_context_counter;
+
+    if (id >= netgridviz_context_states_len) {
+        size_t new_len = (size_t)id * 2;
+        if (new_len > (size_t)UINT16_MAX + 1)
+            new_len = (size_t)UINT16_MAX + 1;
+        netgridviz_context_state* new_states = (netgridviz_context_state*)realloc(
+            netgridviz_context_states, new_len * sizeof(netgridviz_context_state));
+        if (new_states) {
+            netgridviz_context_states = new_states;
+            for (size_t i = netgridviz_context_states_len; i < new_len; ++i) {
+                netgridviz_reset_context_state((uint16_t)i);
+            }
+            netgridviz_context_states_len = new_len;
+        }
+    }
+
+    return netgridviz_make_context(id);
 }
 
 void netgridviz_set_fg(netgridviz_context* context, uint8_t r, uint8_t g, uint8_t b) {
-    if (netgridviz_socket == INVALID_SOCKET)
-        return;
-
     context->fg[0] = r;
     context->fg[1] = g;
     context->fg[2] = b;
-
-    uint8_t message[6] = {GRIDVIZ_SET_FG};
-    memcpy(message + 1, &context->id, sizeof(context->id));
-    memcpy(message + 3, &context->fg[0], sizeof(context->fg));
-
-    ssize_t sent = netgridviz_send_raw(&message[0], sizeof(message));
-    if (sent != sizeof(message))
-        netgridviz_lose_connection();
 }
 
 void netgridviz_set_bg(netgridviz_context* context, uint8_t r, uint8_t g, uint8_t b) {
-    if (netgridviz_socket == INVALID_SOCKET)
-        return;
-
     context->bg[0] = r;
     context->bg[1] = g;
     context->bg[2] = b;
+}
 
-    uint8_t message[6] = {GRIDVIZ_SET_BG};
-    memcpy(message + 1, &context->id, sizeof(context->id));
-    memcpy(message + 3, &context->bg[0], sizeof(context->bg));
+/// Send the colors of the context if they have changed since they were last sent.
+static void netgridviz_sync_context(netgridviz_context* context) {
+    netgridviz_context_state* state = netgridviz_get_context_state(context->id);
+
+    if (!state || memcmp(state->fg, context->fg, sizeof(context->fg)) != 0) {
+        uint8_t message[6] = {GRIDVIZ_SET_FG};
+        memcpy(message + 1, &context->id, sizeof(context->id));
+        memcpy(message + 3, &context->fg[0], sizeof(context->fg));
 
-    ssize_t sent = netgridviz_send_raw(&message[0], sizeof(message));
-    if (sent != sizeof(message))
+        if (netgridviz_send_raw(&message[0], sizeof(message)) < 0) {
+            netgridviz_lose_connection();
+            return;
+        }
+        if (state)
+            memcpy(state->fg, context->fg, sizeof(context->fg));
+    }
+
+    if (!state || memcmp(state->bg, context->bg, sizeof(context->bg)) != 0) {
+        uint8_t message[6] = {GRIDVIZ_SET_BG};
+        memcpy(message + 1, &context->id, sizeof(context->id));
+        memcpy(message + 3, &context->bg[0], sizeof(context->bg));
+
+        if (netgridviz_send_raw(&message[0], sizeof(message)) < 0) {
+            netgridviz_lose_connection();
+            return;
+        }
+        if (state)
+            memcpy(state->bg, context->bg, sizeof(context->bg));
+    }
+}
+
+/////////////////////////////////////////////////
+// Module Code - Compact Encoding
+/////////////////////////////////////////////////
+
+static size_t netgridviz_write_varint(uint8_t* buffer, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buffer[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[len++] = (uint8_t)value;
+    return len;
+}
+
+static uint64_t netgridviz_zigzag_encode(uint64_t delta) {
+    // Move the sign bit to the bottom so small negative numbers are small.
+    return (delta << 1) ^ (0 - (delta >> 63));
+}
+
+static void netgridviz_draw_char_compact(netgridviz_context* context,
+                                         netgridviz_context_state* state,
+                                         int64_t x,
+                                         int64_t y,
+                                         char ch) {
+    // Type + context id + x + y + char.
+    uint8_t message[1 + 3 + 10 + 10 + 1];
+    size_t len = 1;
+    uint8_t type = GRIDVIZ_COMPACT_CHAR;
+
+    if (context->id == netgridviz_last_context_id) {
+        type |= GRIDVIZ_COMPACT_SAME_CONTEXT;
+    } else {
+        len += netgridviz_write_varint(message + len, context->id);
+        netgridviz_last_context_id = context->id;
+    }
+
+    // Use unsigned math so overflow wraps.
+    uint64_t dx = (uint64_t)x - (uint64_t)state->x;
+    uint64_t dy = (uint64_t)y - (uint64_t)state->y;
+    if (dx == 1 && dy == 0) {
+        type |= GRIDVIZ_COMPACT_NEXT_CELL;
+    } else {
+        len += netgridviz_write_varint(message + len, netgridviz_zigzag_encode(dx));
+        len += netgridviz_write_varint(message + len, netgridviz_zigzag_encode(dy));
+    }
+    state->x = x;
+    state->y = y;
+
+    message[0] = type;
+    message[len++] = (uint8_t)ch;
+
+    if (netgridviz_send_raw(&message[0], len) < 0)
         netgridviz_lose_connection();
 }
 
@@ -381,6 +1039,11 @@ static uint8_t netgridviz_has_stroke;
 void netgridviz_start_stroke(const char* title) {
     netgridviz_has_stroke = 1;
 
+    if (netgridviz_socket == INVALID_SOCKET)
+        return;
+
+    // Starting a stroke ends the previous stroke.
+    netgridviz_flush();
     if (netgridviz_socket == INVALID_SOCKET)
         return;
 
@@ -394,28 +1057,26 @@ void netgridviz_start_stroke(const char* title) {
     uint8_t message[5] = {GRIDVIZ_START_STROKE};
     memcpy(message + 1, &len, sizeof(len));
 
-    ssize_t sent = netgridviz_send_raw(&message[0], sizeof(message));
-    if (sent != sizeof(message)) {
+    if (netgridviz_send_raw(&message[0], sizeof(message)) < 0) {
         netgridviz_lose_connection();
         return;
     }
 
     // Send the title.
     if (len > 0) {
-        ssize_t sent = netgridviz_send_raw(&title[0], len);
-        if (sent != len)
+        if (netgridviz_send_raw(&title[0], len) < 0)
             netgridviz_lose_connection();
     }
 }
 
 void netgridviz_end_stroke() {
     netgridviz_has_stroke = 0;
+    netgridviz_flush();
 }
 
 static void netgridviz_start_dummy_stroke(void) {
     uint8_t message[5] = {GRIDVIZ_START_STROKE};
-    ssize_t sent = netgridviz_send_raw(&message[0], sizeof(message));
-    if (sent != sizeof(message))
+    if (netgridviz_send_raw(&message[0], sizeof(message)) < 0)
         netgridviz_lose_connection();
 }
 
@@ -426,32 +1087,63 @@ void netgridviz_draw_char(netgridviz_context* context, int64_t x, int64_t y, cha
     if (!netgridviz_has_stroke)
         netgridviz_start_dummy_stroke();
 
+    netgridviz_sync_context(context);
+    if (netgridviz_socket == INVALID_SOCKET)
+        return;
+
+    netgridviz_context_state* state = netgridviz_get_context_state(context->id);
+    if (netgridviz_compact && state) {
+        netgridviz_draw_char_compact(context, state, x, y, ch);
+        return;
+    }
+
     uint8_t message[20] = {GRIDVIZ_SEND_CHAR};
     memcpy(message + 1, &context->id, sizeof(context->id));
     memcpy(message + 3, &x, sizeof(x));
     memcpy(message + 11, &y, sizeof(y));
     memcpy(message + 19, &ch, sizeof(ch));
 
-    ssize_t sent = netgridviz_send_raw(&message[0], sizeof(message));
-    if (sent != sizeof(message))
+    if (netgridviz_send_raw(&message[0], sizeof(message)) < 0)
         netgridviz_lose_connection();
 }
 
-void netgridviz_draw_string(netgridviz_context* context, int64_t x, int64_t y, const char* string) {
+static void netgridviz_draw_string_len(netgridviz_context* context,
+                                       int64_t x,
+                                       int64_t y,
+                                       const char* string,
+                                       size_t len_s) {
     if (netgridviz_socket == INVALID_SOCKET)
         return;
 
-    uint8_t has_stroke = netgridviz_has_stroke;
-    if (!has_stroke) {
+    if (!netgridviz_has_stroke)
         netgridviz_start_dummy_stroke();
-        netgridviz_has_stroke = 1;
+
+    netgridviz_sync_context(context);
+    if (netgridviz_socket == INVALID_SOCKET)
+        return;
+
+    // Truncate message to `UINT32_MAX`.
+    uint32_t len = ((uint64_t)len_s > (uint64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)len_s);
+
+    uint8_t message[23] = {GRIDVIZ_SEND_STRING};
+    memcpy(message + 1, &context->id, sizeof(context->id));
+    memcpy(message + 3, &x, sizeof(x));
+    memcpy(message + 11, &y, sizeof(y));
+    memcpy(message + 19, &len, sizeof(len));
+
+    if (netgridviz_send_raw(&message[0], sizeof(message)) < 0) {
+        netgridviz_lose_connection();
+        return;
     }
 
-    for (size_t i = 0; string[i] != '\0'; ++i) {
-        netgridviz_draw_char(context, x, y, string[i]);
+    if (len > 0) {
+        if (netgridviz_send_raw(&string[0], len) < 0)
+            netgridviz_lose_connection();
     }
+}
 
-    netgridviz_has_stroke = has_stroke;
+void netgridviz_draw_string(netgridviz_context* context, int64_t x, int64_t y, const char* string) {
+    netgridviz_draw_string_len(context, x, y, string, strlen(string));
 }
 
 void netgridviz_draw_fmt(netgridviz_context* context,
@@ -472,7 +1164,7 @@ void netgridviz_draw_vfmt(netgridviz_context* context,
                           va_list args) {
     va_list args2;
     va_copy(args2, args);
-    int result = snprintf(NULL, 0, format, args2);
+    int result = vsnprintf(NULL, 0, format, args2);
     va_end(args2);
 
     if (result < 0)
@@ -485,16 +1177,91 @@ void netgridviz_draw_vfmt(netgridviz_context* context,
     if (result + 1 > 4096) {
         char* heap_buffer = (char*)malloc(result + 1);
         if (heap_buffer) {
-            snprintf(heap_buffer, result + 1, format, args);
-            netgridviz_draw_string(context, x, y, heap_buffer);
+            vsnprintf(heap_buffer, result + 1, format, args);
+            netgridviz_draw_string_len(context, x, y, heap_buffer, result);
             free(heap_buffer);
             return;
         }
     }
 
     char stack_buffer[4096];
-    snprintf(stack_buffer, sizeof(stack_buffer), format, args);
-    netgridviz_draw_string(context, x, y, stack_buffer);
+    vsnprintf(stack_buffer, sizeof(stack_buffer), format, args);
+    netgridviz_draw_string_len(context, x, y, stack_buffer,
+                               (result < 4095 ? (size_t)result : 4095));
+}
+
+void netgridviz_draw_grid(netgridviz_context* context,
+                          int64_t x,
+                          int64_t y,
+                          uint32_t width,
+                          uint32_t height,
+                          size_t stride,
+                          const char* data) {
+    netgridviz_draw_grid_colored(context, x, y, width, height, stride, data, NULL, NULL);
+}
+
+void netgridviz_draw_grid_colored(netgridviz_context* context,
+                                  int64_t x,
+                                  int64_t y,
+                                  uint32_t width,
+                                  uint32_t height,
+                                  size_t stride,
+                                  const char* data,
+                                  const uint8_t* fg,
+                                  const uint8_t* bg) {
+    if (netgridviz_socket == INVALID_SOCKET)
+        return;
+
+    if (width == 0 || height == 0)
+        return;
+
+    if (!netgridviz_has_stroke)
+        netgridviz_start_dummy_stroke();
+
+    netgridviz_sync_context(context);
+    if (netgridviz_socket == INVALID_SOCKET)
+        return;
+
+    uint8_t flags = 0;
+    if (fg)
+        flags |= GRIDVIZ_GRID_HAS_FG;
+    if (bg)
+        flags |= GRIDVIZ_GRID_HAS_BG;
+
+    uint8_t message[28] = {GRIDVIZ_SEND_GRID};
+    memcpy(message + 1, &context->id, sizeof(context->id));
+    memcpy(message + 3, &x, sizeof(x));
+    memcpy(message + 11, &y, sizeof(y));
+    memcpy(message + 19, &width, sizeof(width));
+    memcpy(message + 23, &height, sizeof(height));
+    memcpy(message + 27, &flags, sizeof(flags));
+
+    if (netgridviz_send_raw(&message[0], sizeof(message)) < 0) {
+        netgridviz_lose_connection();
+        return;
+    }
+
+    // Send the characters row by row to strip out the stride.
+    for (uint32_t row = 0; row < height; ++row) {
+        if (netgridviz_send_raw(data + row * stride, width) < 0) {
+            netgridviz_lose_connection();
+            return;
+        }
+    }
+
+    size_t colors_len = (size_t)width * (size_t)height * 3;
+    if (fg) {
+        if (netgridviz_send_raw(fg, colors_len) < 0) {
+            netgridviz_lose_connection();
+            return;
+        }
+    }
+    if (bg) {
+        if (netgridviz_send_raw(bg, colors_len) < 0) {
+            netgridviz_lose_connection();
+            return;
+        }
+    }
 }
 
 #endif  // NETGRIDVIZ_DEFINE
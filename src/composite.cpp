@@ -0,0 +1,307 @@
+#include "composite.hpp"
+
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Xplat craziness
+///////////////////////////////////////////////////////////////////////////////
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRIDVIZ_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// GCC and Clang can compile AVX2 code for individual functions and check for
+// support at runtime.  MSVC only gets it when the whole program targets AVX2.
+#if defined(GRIDVIZ_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define GRIDVIZ_AVX2 1
+#define GRIDVIZ_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(GRIDVIZ_SSE2) && defined(__AVX2__)
+#define GRIDVIZ_AVX2 1
+#define GRIDVIZ_TARGET_AVX2
+#include <immintrin.h>
+#endif
+
+namespace gridviz {
+
+typedef void (*Composite_Row_Func)(uint32_t* pixels,
+                                   const Composite_Cell* cells,
+                                   size_t count,
+                                   size_t coverage_offset);
+
+static void composite_row_scalar(uint32_t* pixels,
+                                 const Composite_Cell* cells,
+                                 size_t count,
+                                 size_t coverage_offset);
+#ifdef GRIDVIZ_SSE2
+static void composite_row_sse2(uint32_t* pixels,
+                               const Composite_Cell* cells,
+                               size_t count,
+                               size_t coverage_offset);
+#endif
+#ifdef GRIDVIZ_AVX2
+GRIDVIZ_TARGET_AVX2 static void composite_row_avx2(uint32_t* pixels,
+                                                   const Composite_Cell* cells,
+                                                   size_t count,
+                                                   size_t coverage_offset);
+#endif
+
+/// Chosen lazily since checking for processor support isn't safe during static initialization.
+static Composite_Kernel current_kernel;
+static Composite_Row_Func current_func = nullptr;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - dispatch
+///////////////////////////////////////////////////////////////////////////////
+
+static bool is_supported(Composite_Kernel kernel) {
+    switch (kernel) {
+    case COMPOSITE_SCALAR:
+        return true;
+    case COMPOSITE_SSE2:
+#ifdef GRIDVIZ_SSE2
+        return true;
+#else
+        return false;
+#endif
+    case COMPOSITE_AVX2:
+#if defined(GRIDVIZ_AVX2) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#elif defined(GRIDVIZ_AVX2)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+static Composite_Kernel best_kernel() {
+    if (is_supported(COMPOSITE_AVX2))
+        return COMPOSITE_AVX2;
+    if (is_supported(COMPOSITE_SSE2))
+        return COMPOSITE_SSE2;
+    return COMPOSITE_SCALAR;
+}
+
+static Composite_Row_Func get_func(Composite_Kernel kernel) {
+    switch (kernel) {
+    case COMPOSITE_SCALAR:
+        return composite_row_scalar;
+    case COMPOSITE_SSE2:
+#ifdef GRIDVIZ_SSE2
+        return composite_row_sse2;
+#else
+        break;
+#endif
+    case COMPOSITE_AVX2:
+#ifdef GRIDVIZ_AVX2
+        return composite_row_avx2;
+#else
+        break;
+#endif
+    }
+    return composite_row_scalar;
+}
+
+bool set_composite_kernel(Composite_Kernel kernel) {
+    if (!is_supported(kernel))
+        return false;
+    current_kernel = kernel;
+    current_func = get_func(kernel);
+    return true;
+}
+
+static void initialize() {
+    if (!current_func)
+        set_composite_kernel(best_kernel());
+}
+
+Composite_Kernel get_composite_kernel() {
+    initialize();
+    return current_kernel;
+}
+
+void composite_row(uint32_t* pixels,
+                   const Composite_Cell* cells,
+                   size_t count,
+                   size_t coverage_offset) {
+    initialize();
+    current_func(pixels, cells, count, coverage_offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - scalar
+///////////////////////////////////////////////////////////////////////////////
+
+/// Blend each 8 bit channel.  `(t + (t >> 8)) >> 8` is `t / 255` rounded
+/// to nearest for the values that can occur here.  The SIMD kernels
+/// do the same arithmetic so every kernel gives identical results.
+static uint32_t blend_pixel(uint32_t foreground, uint32_t background, uint32_t alpha) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t fg = (foreground >> shift) & 0xff;
+        uint32_t bg = (background >> shift) & 0xff;
+        uint32_t t = bg * (255 - alpha) + fg * alpha + 128;
+        result |= ((t + (t >> 8)) >> 8) << shift;
+    }
+    return result;
+}
+
+static void composite_span_scalar(uint32_t* pixels,
+                                  const uint8_t* coverage,
+                                  uint32_t width,
+                                  uint32_t foreground,
+                                  uint32_t background) {
+    for (uint32_t i = 0; i < width; ++i) {
+        uint8_t alpha = coverage[i];
+        if (alpha == 0)
+            pixels[i] = background;
+        else if (alpha == 255)
+            pixels[i] = foreground;
+        else
+            pixels[i] = blend_pixel(foreground, background, alpha);
+    }
+}
+
+static void composite_row_scalar(uint32_t* pixels,
+                                 const Composite_Cell* cells,
+                                 size_t count,
+                                 size_t coverage_offset) {
+    for (size_t i = 0; i < count; ++i) {
+        const Composite_Cell& cell = cells[i];
+        composite_span_scalar(pixels + cell.x, cell.coverage + coverage_offset, cell.width,
+                              cell.foreground, cell.background);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - SSE2
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef GRIDVIZ_SSE2
+
+/// Blend two pixels worth of 16 bit channels.
+static __m128i blend_sse2(__m128i foreground, __m128i background, __m128i alpha) {
+    __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(background, inverse),
+                              _mm_mullo_epi16(foreground, alpha));
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static void composite_row_sse2(uint32_t* pixels,
+                               const Composite_Cell* cells,
+                               size_t count,
+                               size_t coverage_offset) {
+    const __m128i zero = _mm_setzero_si128();
+
+    for (size_t c = 0; c < count; ++c) {
+        const Composite_Cell& cell = cells[c];
+        uint32_t* out = pixels + cell.x;
+        const uint8_t* coverage = cell.coverage + coverage_offset;
+
+        __m128i fg32 = _mm_set1_epi32((int)cell.foreground);
+        __m128i bg32 = _mm_set1_epi32((int)cell.background);
+        __m128i fg16 = _mm_unpacklo_epi8(fg32, zero);
+        __m128i bg16 = _mm_unpacklo_epi8(bg32, zero);
+
+        uint32_t i = 0;
+        for (; i + 4 <= cell.width; i += 4) {
+            uint32_t alphas;
+            memcpy(&alphas, coverage + i, sizeof(alphas));
+
+            // Empty and solid spans are common so skip the math.
+            __m128i result;
+            if (alphas == 0) {
+                result = bg32;
+            } else if (alphas == 0xffffffff) {
+                result = fg32;
+            } else {
+                // Copy each alpha to all four channels of its pixel.
+                __m128i alpha = _mm_cvtsi32_si128((int)alphas);
+                alpha = _mm_unpacklo_epi8(alpha, alpha);
+                alpha = _mm_unpacklo_epi16(alpha, alpha);
+
+                __m128i low = blend_sse2(fg16, bg16, _mm_unpacklo_epi8(alpha, zero));
+                __m128i high = blend_sse2(fg16, bg16, _mm_unpackhi_epi8(alpha, zero));
+                result = _mm_packus_epi16(low, high);
+            }
+            _mm_storeu_si128((__m128i*)(out + i), result);
+        }
+
+        composite_span_scalar(out + i, coverage + i, cell.width - i, cell.foreground,
+                              cell.background);
+    }
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - AVX2
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef GRIDVIZ_AVX2
+
+/// Blend four pixels worth of 16 bit channels.
+GRIDVIZ_TARGET_AVX2 static __m256i blend_avx2(__m256i foreground,
+                                              __m256i background,
+                                              __m256i alpha) {
+    __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(background, inverse),
+                                 _mm256_mullo_epi16(foreground, alpha));
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+GRIDVIZ_TARGET_AVX2 static void composite_row_avx2(uint32_t* pixels,
+                                                   const Composite_Cell* cells,
+                                                   size_t count,
+                                                   size_t coverage_offset) {
+    const __m256i zero = _mm256_setzero_si256();
+    // Copy alpha `i` to all four channels of pixel `i`.
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,  //
+                                            4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7);
+
+    for (size_t c = 0; c < count; ++c) {
+        const Composite_Cell& cell = cells[c];
+        uint32_t* out = pixels + cell.x;
+        const uint8_t* coverage = cell.coverage + coverage_offset;
+
+        __m256i fg32 = _mm256_set1_epi32((int)cell.foreground);
+        __m256i bg32 = _mm256_set1_epi32((int)cell.background);
+        __m256i fg16 = _mm256_unpacklo_epi8(fg32, zero);
+        __m256i bg16 = _mm256_unpacklo_epi8(bg32, zero);
+
+        uint32_t i = 0;
+        for (; i + 8 <= cell.width; i += 8) {
+            uint64_t alphas;
+            memcpy(&alphas, coverage + i, sizeof(alphas));
+
+            __m256i result;
+            if (alphas == 0) {
+                result = bg32;
+            } else if (alphas == UINT64_MAX) {
+                result = fg32;
+            } else {
+                __m128i packed = _mm_loadl_epi64((const __m128i*)(coverage + i));
+                __m256i alpha = _mm256_shuffle_epi8(_mm256_broadcastq_epi64(packed), spread);
+
+                // Unpacking and packing work within each 128 bit lane so the order is kept.
+                __m256i low = blend_avx2(fg16, bg16, _mm256_unpacklo_epi8(alpha, zero));
+                __m256i high = blend_avx2(fg16, bg16, _mm256_unpackhi_epi8(alpha, zero));
+                result = _mm256_packus_epi16(low, high);
+            }
+            _mm256_storeu_si256((__m256i*)(out + i), result);
+        }
+
+        composite_span_scalar(out + i, coverage + i, cell.width - i, cell.foreground,
+                              cell.background);
+    }
+}
+
+#endif
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace gridviz {
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/// A cell to be blended by `composite_row`.  Colors are packed
+/// pixels of a 32 bit format where every channel is 8 bits.
+struct Composite_Cell {
+    /// Coverage of the first visible column of the glyph.
+    const uint8_t* coverage;
+    uint32_t foreground;
+    uint32_t background;
+
+    /// The visible pixels are `[x, x + width)`.
+    uint32_t x;
+    uint32_t width;
+};
+
+enum Composite_Kernel {
+    COMPOSITE_SCALAR,
+    COMPOSITE_SSE2,
+    COMPOSITE_AVX2,
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Function Declarations
+///////////////////////////////////////////////////////////////////////////////
+
+/// Blend between the background and foreground of each cell by the coverage at
+/// `cell.coverage + coverage_offset` and write the result into `pixels`.
+void composite_row(uint32_t* pixels,
+                   const Composite_Cell* cells,
+                   size_t count,
+                   size_t coverage_offset);
+
+/// The fastest kernel supported by the processor is used by default.  Returns
+/// false and leaves the kernel unchanged if `kernel` isn't supported.
+bool set_composite_kernel(Composite_Kernel kernel);
+Composite_Kernel get_composite_kernel();
+
+}
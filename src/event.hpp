@@ -1,34 +1,153 @@
 #pragma once
 
 #include <stdint.h>
+#include <cz/buffer_array.hpp>
 #include <cz/date.hpp>
 #include <cz/str.hpp>
+#include <cz/string.hpp>
 #include <cz/vector.hpp>
 
 namespace gridviz {
 
-enum Event_Type {
-    EVENT_CHAR_POINT,
+/// The foreground and background color of a cell.
+struct Color_Pair {
+    uint8_t fg[3];
+    uint8_t bg[3];
 };
 
-union Event {
+/// Index into `Run_Info::palette`.
+typedef uint16_t Palette_Index;
+
+/// Maximum number of colors in a run's palette.  Cells with colors
+/// that don't fit in the palette are stored as 1x1 blocks instead.
+const size_t max_palette_size = 1 << 16;
+
+/// An inclusive rectangle of cells.  Empty if `min_x > max_x`.
+struct Bounds {
+    int64_t min_x, min_y;
+    int64_t max_x, max_y;
+};
+
+inline Bounds empty_bounds() {
+    return {INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN};
+}
+
+inline void extend_bounds(Bounds* bounds, const Bounds& other) {
+    if (other.min_x < bounds->min_x)
+        bounds->min_x = other.min_x;
+    if (other.min_y < bounds->min_y)
+        bounds->min_y = other.min_y;
+    if (other.max_x > bounds->max_x)
+        bounds->max_x = other.max_x;
+    if (other.max_y > bounds->max_y)
+        bounds->max_y = other.max_y;
+}
+
+inline bool bounds_intersect(const Bounds& left, const Bounds& right) {
+    return left.min_x <= right.max_x && right.min_x <= left.max_x &&
+           left.min_y <= right.max_y && right.min_y <= left.max_y;
+}
+
+inline bool bounds_contain(const Bounds& outer, const Bounds& inner) {
+    return outer.min_x <= inner.min_x && inner.max_x <= outer.max_x &&
+           outer.min_y <= inner.min_y && inner.max_y <= outer.max_y;
+}
+
+/// A sequence of characters drawn one at a time.  The cells are `[start, end)` in the
+/// stroke's cell columns.  Cell positions are stored as offsets from `(x, y)`.
+struct Chunk {
+    int64_t x, y;
+    uint32_t start, end;
+
+    /// Bounding box of the offsets.
+    int16_t min_dx, min_dy;
+    int16_t max_dx, max_dy;
+};
+
+/// Chunks are capped at this many cells so their bounding boxes stay small.
+const uint32_t max_chunk_cells = 4096;
+
+enum Segment_Type {
+    SEGMENT_CHUNK,
+    SEGMENT_BLOCK,
+};
+
+/// Draw commands are replayed in the order of the segments.
+struct Segment {
     uint8_t type;
-    struct {
-        uint8_t type;
-        uint8_t fg[3];
-        uint8_t bg[3];
-        uint8_t ch;
-        int64_t x, y;
-    } cp;
+    uint32_t index;  // Index into `Stroke::chunks` or `Stroke::blocks`.
+};
+
+enum Block_Flags {
+    BLOCK_HAS_FG = 1,
+    BLOCK_HAS_BG = 2,
+};
+
+/// A dense rectangle of characters.  Strings are stored as blocks with a height of one.
+struct Block {
+    int64_t x, y;
+    uint32_t width, height;
+    uint8_t flags;
+
+    /// Colors used for every cell unless the block has per cell colors.
+    uint8_t fg[3];
+    uint8_t bg[3];
+
+    /// Offsets into `Stroke::data`.  There are `width * height` characters
+    /// and, if the corresponding flag is set, `width * height` RGB triples.
+    size_t chars;
+    size_t fgs;
+    size_t bgs;
 };
 
 struct Stroke {
     cz::Str title;
-    cz::Vector<Event> events;
+
+    /// Bounding box of every cell drawn in the stroke.
+    Bounds bounds;
+
+    cz::Vector<Segment> segments;
+    cz::Vector<Chunk> chunks;
+    cz::Vector<Block> blocks;
+    cz::String data;
+
+    /// Cells of all the chunks stored as columns.
+    cz::Vector<int16_t> cell_dxs;
+    cz::Vector<int16_t> cell_dys;
+    cz::Vector<Palette_Index> cell_colors;
+    cz::Vector<uint8_t> cell_chars;
 };
 
+struct Keyframe;
+struct View;
+struct Minimap;
+struct Timeline;
+struct Session;
+
 struct Run_Info {
     cz::Vector<Stroke> strokes;
+    cz::Vector<Color_Pair> palette;
+
+    /// Owns the titles of the strokes received over the network so they are allocated a
+    /// buffer at a time.  Created by `run_allocator`.  Null if nothing was allocated.
+    cz::Buffer_Array* arena;
+
+    /// Snapshots built by the keyframe worker.  Sorted by `Keyframe::stroke`.
+    cz::Vector<Keyframe*> keyframes;
+    /// Strokes before this have been sent to the keyframe worker.
+    size_t keyframe_end;
+    /// There can only be one job per run since each keyframe is built from the previous one.
+    bool keyframe_pending;
+
+    /// The resolved grid at the selected stroke.  Created when first rendered.
+    View* view;
+    /// Overview of the latest state of the run.  Created when first selected.
+    Minimap* minimap;
+    /// Layout of the stroke list.  Created when the timeline is first drawn.
+    Timeline* timeline;
+    /// The file the run is recorded to or was opened from.  Null if neither.
+    Session* session;
+
     // TODO pull out graphical stuff
     size_t selected_stroke;
     int64_t off_x;
@@ -0,0 +1,324 @@
+#include "grid.hpp"
+
+#include <string.h>
+#include <atomic>
+#include <cz/binary_search.hpp>
+#include <cz/heap.hpp>
+
+#include "session.hpp"
+
+namespace gridviz {
+
+/// Every grid gets a unique generation so it can tell which tiles it owns.
+static std::atomic<uint64_t> generation_counter;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - lifetime
+///////////////////////////////////////////////////////////////////////////////
+
+void fork_grid(Grid* grid, const Grid* base) {
+    *grid = {};
+    grid->generation = ++generation_counter;
+    if (base) {
+        grid->tiles.reserve(cz::heap_allocator(), base->tiles.len);
+        grid->tiles.append(base->tiles.as_slice());
+    }
+}
+
+void drop_grid(Grid* grid) {
+    for (size_t i = 0; i < grid->tiles.len; ++i) {
+        Tile* tile = grid->tiles[i];
+        if (tile->generation == grid->generation)
+            cz::heap_allocator().dealloc(tile);
+    }
+    grid->tiles.drop(cz::heap_allocator());
+}
+
+void drop_stroke(Stroke* stroke) {
+    stroke->segments.drop(cz::heap_allocator());
+    stroke->chunks.drop(cz::heap_allocator());
+    stroke->blocks.drop(cz::heap_allocator());
+    stroke->data.drop(cz::heap_allocator());
+    stroke->cell_dxs.drop(cz::heap_allocator());
+    stroke->cell_dys.drop(cz::heap_allocator());
+    stroke->cell_colors.drop(cz::heap_allocator());
+    stroke->cell_chars.drop(cz::heap_allocator());
+}
+
+cz::Allocator run_allocator(Run_Info* run) {
+    if (!run->arena) {
+        run->arena = cz::heap_allocator().alloc<cz::Buffer_Array>();
+        run->arena->init();
+    }
+    return run->arena->allocator();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - writing
+///////////////////////////////////////////////////////////////////////////////
+
+static int64_t compare_tiles(Tile* const& left, Tile* const& right) {
+    if (left->y != right->y)
+        return (left->y < right->y ? -1 : 1);
+    if (left->x != right->x)
+        return (left->x < right->x ? -1 : 1);
+    return 0;
+}
+
+/// Find the index of the tile or where it would be inserted.
+size_t find_tile(const Grid* grid, int64_t tile_x, int64_t tile_y) {
+    Tile fake_tile;
+    fake_tile.x = tile_x;
+    fake_tile.y = tile_y;
+    Tile* fake_pointer = &fake_tile;
+
+    size_t index;
+    (void)cz::binary_search(grid->tiles.as_slice(), fake_pointer, &index, compare_tiles);
+    return index;
+}
+
+/// Get a tile owned by the grid that can be written to.
+static Tile* get_tile(Grid* grid, int64_t tile_x, int64_t tile_y) {
+    Tile* tile = grid->last_tile;
+    if (tile && tile->x == tile_x && tile->y == tile_y)
+        return tile;
+
+    size_t index = find_tile(grid, tile_x, tile_y);
+    if (index < grid->tiles.len && grid->tiles[index]->x == tile_x &&
+        grid->tiles[index]->y == tile_y) {
+        tile = grid->tiles[index];
+        if (tile->generation != grid->generation) {
+            // Copy on write.
+            Tile* copy = cz::heap_allocator().alloc<Tile>();
+            memcpy(copy, tile, sizeof(Tile));
+            copy->generation = grid->generation;
+            grid->tiles[index] = copy;
+            tile = copy;
+        }
+    } else {
+        tile = cz::heap_allocator().alloc<Tile>();
+        memset(tile, 0, sizeof(Tile));
+        tile->x = tile_x;
+        tile->y = tile_y;
+        tile->generation = grid->generation;
+        grid->tiles.reserve(cz::heap_allocator(), 1);
+        grid->tiles.insert(index, tile);
+    }
+
+    grid->last_tile = tile;
+    return tile;
+}
+
+template <class Summary>
+static void add_to_summary(Summary* summary, const uint8_t fg[3], const uint8_t bg[3], uint8_t ch) {
+    for (int i = 0; i < 3; ++i) {
+        summary->fg_sums[i] += fg[i];
+        summary->bg_sums[i] += bg[i];
+    }
+    summary->count++;
+    summary->ink += !is_blank(ch);
+}
+
+template <class Summary>
+static void remove_from_summary(Summary* summary,
+                                const uint8_t fg[3],
+                                const uint8_t bg[3],
+                                uint8_t ch) {
+    for (int i = 0; i < 3; ++i) {
+        summary->fg_sums[i] -= fg[i];
+        summary->bg_sums[i] -= bg[i];
+    }
+    summary->count--;
+    summary->ink -= !is_blank(ch);
+}
+
+void set_cell(Grid* grid,
+              int64_t x,
+              int64_t y,
+              uint8_t ch,
+              const uint8_t fg[3],
+              const uint8_t bg[3]) {
+    // Arithmetic shift rounds towards negative infinity so negative cells work.
+    Tile* tile = get_tile(grid, x >> tile_shift, y >> tile_shift);
+
+    int64_t column = x & (tile_size - 1);
+    int64_t row = y & (tile_size - 1);
+    size_t cell = (size_t)(row * tile_size + column);
+
+    // Replace the cell's contribution to the summaries.
+    Cell_Summary* summary = &tile->summaries[(row >> summary_shift) * summaries_per_row +
+                                             (column >> summary_shift)];
+    if (tile->occupied[row] & ((uint64_t)1 << column)) {
+        remove_from_summary(summary, tile->fgs[cell], tile->bgs[cell], tile->chars[cell]);
+        remove_from_summary(&tile->summary, tile->fgs[cell], tile->bgs[cell], tile->chars[cell]);
+    }
+    add_to_summary(summary, fg, bg, ch);
+    add_to_summary(&tile->summary, fg, bg, ch);
+
+    tile->occupied[row] |= (uint64_t)1 << column;
+    tile->chars[cell] = ch;
+    memcpy(tile->fgs[cell], fg, 3);
+    memcpy(tile->bgs[cell], bg, 3);
+}
+
+static void apply_block(Grid* grid,
+                        const Stroke* stroke,
+                        const Block& block,
+                        const Bounds* region) {
+    const uint8_t* chars = (const uint8_t*)stroke->data.buffer + block.chars;
+    const uint8_t* fgs = (const uint8_t*)stroke->data.buffer + block.fgs;
+    const uint8_t* bgs = (const uint8_t*)stroke->data.buffer + block.bgs;
+
+    // Clip the block to the region.
+    int64_t start_column = 0, end_column = block.width;
+    int64_t start_row = 0, end_row = block.height;
+    if (region) {
+        start_column = cz::max(start_column, region->min_x - block.x);
+        end_column = cz::min(end_column, region->max_x - block.x + 1);
+        start_row = cz::max(start_row, region->min_y - block.y);
+        end_row = cz::min(end_row, region->max_y - block.y + 1);
+    }
+
+    for (int64_t row = start_row; row < end_row; ++row) {
+        for (int64_t column = start_column; column < end_column; ++column) {
+            size_t cell = (size_t)row * block.width + column;
+            const uint8_t* fg = (block.flags & BLOCK_HAS_FG) ? fgs + cell * 3 : block.fg;
+            const uint8_t* bg = (block.flags & BLOCK_HAS_BG) ? bgs + cell * 3 : block.bg;
+            set_cell(grid, block.x + column, block.y + row, chars[cell], fg, bg);
+        }
+    }
+}
+
+static void apply_chunk(Grid* grid,
+                        const Stroke* stroke,
+                        const Chunk& chunk,
+                        const Color_Pair* palette,
+                        const Bounds* region) {
+    if (region) {
+        Bounds bounds = {chunk.x + chunk.min_dx, chunk.y + chunk.min_dy, chunk.x + chunk.max_dx,
+                         chunk.y + chunk.max_dy};
+        if (!bounds_intersect(*region, bounds))
+            return;
+        // Only check each cell if the chunk is partially outside of the region.
+        if (bounds_contain(*region, bounds))
+            region = nullptr;
+    }
+
+    for (uint32_t cell = chunk.start; cell < chunk.end; ++cell) {
+        int64_t x = chunk.x + stroke->cell_dxs[cell];
+        int64_t y = chunk.y + stroke->cell_dys[cell];
+        if (region && (x < region->min_x || x > region->max_x || y < region->min_y ||
+                       y > region->max_y)) {
+            continue;
+        }
+        const Color_Pair& pair = palette[stroke->cell_colors[cell]];
+        set_cell(grid, x, y, stroke->cell_chars[cell], pair.fg, pair.bg);
+    }
+}
+
+void apply_stroke(Grid* grid,
+                  const Stroke* stroke,
+                  const Color_Pair* palette,
+                  const Bounds* region) {
+    apply_segments(grid, stroke, 0, stroke->segments.len, palette, region);
+}
+
+void apply_segments(Grid* grid,
+                    const Stroke* stroke,
+                    size_t start,
+                    size_t end,
+                    const Color_Pair* palette,
+                    const Bounds* region) {
+    // The stroke's bounding box is the top level of the spatial index.
+    if (region && !bounds_intersect(*region, stroke->bounds))
+        return;
+
+    for (size_t i = start; i < end; ++i) {
+        const Segment& segment = stroke->segments[i];
+        if (segment.type == SEGMENT_CHUNK) {
+            apply_chunk(grid, stroke, stroke->chunks[segment.index], palette, region);
+        } else {
+            apply_block(grid, stroke, stroke->blocks[segment.index], region);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - keyframes
+///////////////////////////////////////////////////////////////////////////////
+
+static int64_t compare_keyframes(Keyframe* const& left, Keyframe* const& right) {
+    return (int64_t)left->stroke - (int64_t)right->stroke;
+}
+
+Keyframe* find_keyframe(cz::Slice<Keyframe*> keyframes, size_t stroke) {
+    Keyframe fake_keyframe;
+    fake_keyframe.stroke = stroke;
+    Keyframe* fake_pointer = &fake_keyframe;
+
+    size_t index;
+    if (cz::binary_search(keyframes, fake_pointer, &index, compare_keyframes))
+        return keyframes[index];
+    if (index == 0)
+        return nullptr;
+    return keyframes[index - 1];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - view
+///////////////////////////////////////////////////////////////////////////////
+
+const Grid* resolve_grid(Run_Info* run, size_t end, const Bounds& visible) {
+    if (!run->view) {
+        run->view = cz::heap_allocator().alloc<View>();
+        *run->view = {};
+    }
+
+    View* view = run->view;
+    const Color_Pair* palette = run->palette.elems;
+
+    // Going backwards requires starting over.  Going forwards past a keyframe is
+    // cheaper to do by starting over from the keyframe than by replaying.  Scrolling
+    // outside of the region also requires starting over since cells were skipped.
+    Keyframe* keyframe = find_keyframe(run->keyframes, end);
+    if (!view->valid || end < view->stroke || (keyframe && keyframe->stroke > view->stroke) ||
+        !bounds_contain(view->region, visible)) {
+        drop_grid(&view->grid);
+        fork_grid(&view->grid, keyframe ? &keyframe->grid : nullptr);
+        view->valid = true;
+
+        // Materialize a margin of half a screen on each side so small scrolls are free.
+        int64_t margin_x = (visible.max_x - visible.min_x) / 2 + 1;
+        int64_t margin_y = (visible.max_y - visible.min_y) / 2 + 1;
+        view->region = {visible.min_x - margin_x, visible.min_y - margin_y,
+                        visible.max_x + margin_x, visible.max_y + margin_y};
+        view->stroke = (keyframe ? keyframe->stroke : 0);
+        // Keyframes only contain completed strokes.
+        if (view->stroke > 0)
+            load_stroke(run, view->stroke - 1);
+        view->segment = (view->stroke > 0 ? run->strokes[view->stroke - 1].segments.len : 0);
+    }
+
+    // The last stroke we applied may have grown since.  It could have been
+    // evicted since it was applied if this run wasn't shown so read it back.
+    if (view->stroke > 0) {
+        load_stroke(run, view->stroke - 1);
+        const Stroke* stroke = &run->strokes[view->stroke - 1];
+        apply_segments(&view->grid, stroke, view->segment, stroke->segments.len, palette,
+                       &view->region);
+        view->segment = stroke->segments.len;
+    }
+
+    for (; view->stroke < end; ++view->stroke) {
+        // Strokes that aren't in memory are only read once they are seen.
+        const Stroke* stroke = &run->strokes[view->stroke];
+        if (bounds_intersect(view->region, stroke->bounds))
+            load_stroke(run, view->stroke);
+        apply_stroke(&view->grid, stroke, palette, &view->region);
+        view->segment = stroke->segments.len;
+    }
+
+    return &view->grid;
+}
+
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <stdint.h>
+#include <cz/util.hpp>
+#include <cz/vector.hpp>
+
+#include "event.hpp"
+
+namespace gridviz {
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+const int tile_shift = 6;
+const int64_t tile_size = 1 << tile_shift;
+
+const int summary_shift = 3;
+const int64_t summary_size = 1 << summary_shift;
+const int64_t summaries_per_row = tile_size / summary_size;
+
+/// Spaces and control characters draw nothing.
+inline bool is_blank(uint8_t ch) {
+    return ch <= ' ';
+}
+
+/// Totals of the drawn cells in a `summary_size` square of a
+/// tile.  Used to draw the grid when zoomed far out.
+struct Cell_Summary {
+    uint16_t fg_sums[3];
+    uint16_t bg_sums[3];
+    /// Number of drawn cells.
+    uint8_t count;
+    /// Number of drawn cells that aren't blank.
+    uint8_t ink;
+};
+
+/// Same as `Cell_Summary` but for an entire tile.
+struct Tile_Summary {
+    uint32_t fg_sums[3];
+    uint32_t bg_sums[3];
+    uint16_t count;
+    uint16_t ink;
+};
+
+/// A `tile_size` by `tile_size` square of resolved cells.
+struct Tile {
+    /// Position in tiles.  The top left cell is `(x * tile_size, y * tile_size)`.
+    int64_t x, y;
+
+    /// The grid generation that owns this tile.  Tiles owned by an older
+    /// generation are shared with other grids and are copied before writing.
+    uint64_t generation;
+
+    /// Kept next to the position so drawing far zoomed out only touches one cache line.
+    Tile_Summary summary;
+
+    /// Bit `column` of `occupied[row]` is set if the cell has been drawn.
+    uint64_t occupied[tile_size];
+    uint8_t chars[tile_size * tile_size];
+    uint8_t fgs[tile_size * tile_size][3];
+    uint8_t bgs[tile_size * tile_size][3];
+
+    /// Indexed by `(row / summary_size) * summaries_per_row + column / summary_size`.
+    /// Kept up to date by `set_cell` so shared tiles are never written to.
+    Cell_Summary summaries[summaries_per_row * summaries_per_row];
+};
+
+/// A sparse grid of the final state of every cell after applying some strokes.
+struct Grid {
+    /// Sorted by `(y, x)`.
+    cz::Vector<Tile*> tiles;
+    uint64_t generation;
+
+    /// The tile written to by the previous call to `set_cell`.
+    Tile* last_tile;
+};
+
+/// A snapshot of the grid after the first `stroke` strokes of a run.
+struct Keyframe {
+    size_t stroke;
+    Grid grid;
+};
+
+/// The grid at the selected stroke.  Updated incrementally when
+/// the selection moves forward or the last stroke grows.
+struct View {
+    Grid grid;
+    bool valid;
+
+    /// Only cells inside this region have been applied.  Tiles copied from
+    /// a keyframe may also have cells outside it but those aren't updated.
+    Bounds region;
+
+    /// The first `stroke` strokes have been applied.  Only the first
+    /// `segment` segments of the last of them have been applied.
+    size_t stroke;
+    size_t segment;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Function Declarations
+///////////////////////////////////////////////////////////////////////////////
+
+/// Make a copy of `base` that shares its tiles.
+void fork_grid(Grid* grid, const Grid* base);
+
+/// Drop the tiles owned by the grid.  Shared tiles are left alone.
+void drop_grid(Grid* grid);
+
+/// Drop the draw commands of the stroke.  The title isn't owned by the stroke.
+void drop_stroke(Stroke* stroke);
+
+/// Allocate memory that lives as long as the run.  Creates the run's arena if needed.
+/// Only titles are allocated here.  Draw commands stay on the heap since the last stroke
+/// grows while it streams in and recorded strokes are evicted one at a time.
+cz::Allocator run_allocator(Run_Info* run);
+
+void set_cell(Grid* grid,
+              int64_t x,
+              int64_t y,
+              uint8_t ch,
+              const uint8_t fg[3],
+              const uint8_t bg[3]);
+
+/// Apply all of the draw commands in the stroke.  If `region` is
+/// non-null then only the cells inside of it are applied.
+void apply_stroke(Grid* grid,
+                  const Stroke* stroke,
+                  const Color_Pair* palette,
+                  const Bounds* region);
+/// Apply the draw commands in the segments `[start, end)` of the stroke.
+void apply_segments(Grid* grid,
+                    const Stroke* stroke,
+                    size_t start,
+                    size_t end,
+                    const Color_Pair* palette,
+                    const Bounds* region);
+
+/// Find the last keyframe at or before `stroke`.  Returns null if there is none.
+Keyframe* find_keyframe(cz::Slice<Keyframe*> keyframes, size_t stroke);
+
+/// Get the grid after applying the first `end` strokes of the run.  Only
+/// the cells inside `visible` are guaranteed to be correct.  Strokes
+/// that don't touch the materialized region around it are skipped.
+const Grid* resolve_grid(Run_Info* run, size_t end, const Bounds& visible);
+
+/// Get the tiles that intersect the rectangle of cells from `(x, y)` to `(x + width, y +
+/// height)`.  Tiles are visited in order and each one is visited once.
+template <class Callback>
+void for_each_tile(const Grid* grid,
+                   int64_t x,
+                   int64_t y,
+                   int64_t width,
+                   int64_t height,
+                   Callback&& callback);
+
+///////////////////////////////////////////////////////////////////////////////
+// Template Implementations
+///////////////////////////////////////////////////////////////////////////////
+
+size_t find_tile(const Grid* grid, int64_t tile_x, int64_t tile_y);
+
+template <class Callback>
+void for_each_tile(const Grid* grid,
+                   int64_t x,
+                   int64_t y,
+                   int64_t width,
+                   int64_t height,
+                   Callback&& callback) {
+    if (width <= 0 || height <= 0)
+        return;
+
+    if (grid->tiles.len == 0)
+        return;
+
+    int64_t start_x = x >> tile_shift;
+    int64_t start_y = y >> tile_shift;
+    int64_t end_x = (x + width - 1) >> tile_shift;
+    int64_t end_y = (y + height - 1) >> tile_shift;
+
+    // Don't visit empty rows when zoomed far out.
+    start_y = cz::max(start_y, grid->tiles[0]->y);
+    end_y = cz::min(end_y, grid->tiles.last()->y);
+
+    for (int64_t tile_y = start_y; tile_y <= end_y; ++tile_y) {
+        // Tiles are sorted by row so the visible tiles in each row are contiguous.
+        size_t index = find_tile(grid, start_x, tile_y);
+        for (; index < grid->tiles.len; ++index) {
+            const Tile* tile = grid->tiles[index];
+            if (tile->y != tile_y || tile->x > end_x)
+                break;
+            callback(tile);
+        }
+    }
+}
+
+}
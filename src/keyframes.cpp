@@ -0,0 +1,236 @@
+#include "keyframes.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+
+#include "event.hpp"
+#include "grid.hpp"
+#include "session.hpp"
+#include "spsc_queue.hpp"
+
+namespace gridviz {
+
+static void worker_main(Keyframe_State* state);
+
+/// Build a keyframe after this many cells have been drawn since the previous keyframe.
+static const size_t keyframe_cell_budget = 1 << 16;
+/// Build a keyframe after this many strokes even if they are small.
+static const size_t keyframe_stroke_interval = 256;
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+struct Keyframe_Job {
+    size_t run;
+    const Keyframe* base;
+
+    /// Shallow copies of the strokes.  Strokes are immutable once the next one starts.
+    cz::Vector<Stroke> strokes;
+    /// Copy of the run's palette since the main thread can grow it.
+    cz::Vector<Color_Pair> palette;
+
+    /// Strokes that were evicted or never read from the run's session are read from
+    /// `file` instead.  `offsets[i]` is the position of the record of `strokes[i]`
+    /// and there is one more element than the number of strokes that are stored.
+    FILE* file;
+    cz::Vector<uint64_t> offsets;
+
+    Keyframe* result;
+};
+
+struct Keyframe_State {
+    std::atomic<bool> stop;
+    std::thread thread;
+
+    /// Wakes up the worker when there are jobs.
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    Spsc_Queue<Keyframe_Job*, 64> jobs;
+    Spsc_Queue<Keyframe_Job*, 64> results;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - lifetime
+///////////////////////////////////////////////////////////////////////////////
+
+Keyframe_State* start_keyframes() {
+    Keyframe_State* state = cz::heap_allocator().alloc<Keyframe_State>();
+    new (state) Keyframe_State();
+    state->thread = std::thread(worker_main, state);
+    return state;
+}
+
+static void drop_job(Keyframe_Job* job) {
+    job->strokes.drop(cz::heap_allocator());
+    job->palette.drop(cz::heap_allocator());
+    job->offsets.drop(cz::heap_allocator());
+    cz::heap_allocator().dealloc(job);
+}
+
+void stop_keyframes(Keyframe_State* state) {
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->stop = true;
+    }
+    state->condition.notify_one();
+    state->thread.join();
+
+    Keyframe_Job* job;
+    while (state->jobs.pop(&job)) {
+        drop_job(job);
+    }
+    while (state->results.pop(&job)) {
+        if (job->result) {
+            drop_grid(&job->result->grid);
+            cz::heap_allocator().dealloc(job->result);
+        }
+        drop_job(job);
+    }
+
+    state->~Keyframe_State();
+    cz::heap_allocator().dealloc(state);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - main thread
+///////////////////////////////////////////////////////////////////////////////
+
+static size_t stroke_cost(const Run_Info* run, size_t index) {
+    // Strokes that aren't in memory are estimated from their size on disk.
+    const Session* session = run->session;
+    if (session && index < session->resident.len && !session->resident[index])
+        return (size_t)(session->offsets[index + 1] - session->offsets[index]) / 4;
+
+    // Block data is a close enough approximation of the number of cells in blocks.
+    const Stroke* stroke = &run->strokes[index];
+    return stroke->cell_chars.len + stroke->data.len;
+}
+
+static void schedule_keyframe(Keyframe_State* state, Game_State* game, size_t run_index) {
+    Run_Info* run = &game->runs[run_index];
+    if (run->keyframe_pending)
+        return;
+
+    // The last stroke can still be added to by the client.
+    if (run->strokes.len == 0)
+        return;
+    size_t completed = run->strokes.len - 1;
+
+    size_t end = run->keyframe_end;
+    size_t cost = 0;
+    while (end < completed && cost < keyframe_cell_budget &&
+           end - run->keyframe_end < keyframe_stroke_interval) {
+        cost += stroke_cost(run, end);
+        ++end;
+    }
+    if (cost < keyframe_cell_budget && end - run->keyframe_end < keyframe_stroke_interval)
+        return;
+
+    Keyframe_Job* job = cz::heap_allocator().alloc<Keyframe_Job>();
+    *job = {};
+    job->run = run_index;
+    job->base = (run->keyframes.len > 0 ? run->keyframes.last() : nullptr);
+    job->strokes.reserve_exact(cz::heap_allocator(), end - run->keyframe_end);
+    job->strokes.append(run->strokes.slice(run->keyframe_end, end));
+    job->palette = run->palette.clone(cz::heap_allocator());
+
+    const Session* session = run->session;
+    if (session && run->keyframe_end < session->resident.len) {
+        size_t stored = cz::min(end, session->resident.len);
+        job->file = session->worker_file;
+        job->offsets.reserve_exact(cz::heap_allocator(), stored - run->keyframe_end + 1);
+        job->offsets.append(session->offsets.slice(run->keyframe_end, stored + 1));
+    }
+
+    {
+        // Push under the lock so the worker can't miss the job between checking and waiting.
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->jobs.push(job)) {
+            drop_job(job);
+            return;
+        }
+    }
+    state->condition.notify_one();
+
+    run->keyframe_end = end;
+    run->keyframe_pending = true;
+}
+
+void poll_keyframes(Keyframe_State* state, Game_State* game) {
+    Keyframe_Job* job;
+    while (state->results.pop(&job)) {
+        Run_Info* run = &game->runs[job->run];
+        run->keyframes.reserve(cz::heap_allocator(), 1);
+        run->keyframes.push(job->result);
+        run->keyframe_pending = false;
+        drop_job(job);
+    }
+
+    for (size_t i = 0; i < game->runs.len; ++i) {
+        schedule_keyframe(state, game, i);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - worker thread
+///////////////////////////////////////////////////////////////////////////////
+
+static void build_keyframe(Keyframe_Job* job) {
+    Keyframe* keyframe = cz::heap_allocator().alloc<Keyframe>();
+    fork_grid(&keyframe->grid, job->base ? &job->base->grid : nullptr);
+
+    Stroke loaded = {};
+    for (size_t i = 0; i < job->strokes.len; ++i) {
+        const Stroke* stroke = &job->strokes[i];
+        // Strokes that aren't in memory only have their title and bounds.
+        if (stroke->segments.len == 0 && i + 1 < job->offsets.len) {
+            if (!read_stroke(job->file, job->offsets[i], job->offsets[i + 1],
+                             job->palette.len, &loaded)) {
+                continue;
+            }
+            stroke = &loaded;
+        }
+        apply_stroke(&keyframe->grid, stroke, job->palette.elems, nullptr);
+    }
+    drop_stroke(&loaded);
+
+    keyframe->stroke = (job->base ? job->base->stroke : 0) + job->strokes.len;
+    job->result = keyframe;
+}
+
+static void worker_main(Keyframe_State* state) {
+    while (1) {
+        Keyframe_Job* job;
+        if (!state->jobs.pop(&job)) {
+            // Sleep until there is a job.  Jobs are pushed while holding the lock.
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->condition.wait(lock, [&] { return state->stop || !state->jobs.empty(); });
+            if (state->stop)
+                return;
+            continue;
+        }
+
+        build_keyframe(job);
+
+        // Wait for the main thread to make room.
+        while (!state->results.push(job)) {
+            if (state->stop) {
+                drop_grid(&job->result->grid);
+                cz::heap_allocator().dealloc(job->result);
+                drop_job(job);
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+}
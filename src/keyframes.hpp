@@ -0,0 +1,14 @@
+#pragma once
+
+namespace gridviz {
+
+struct Keyframe_State;
+struct Game_State;
+
+/// Keyframes are built on a background thread so selecting a stroke
+/// only has to replay the strokes after the nearest keyframe.
+Keyframe_State* start_keyframes();
+void poll_keyframes(Keyframe_State* state, Game_State* game);
+void stop_keyframes(Keyframe_State* state);
+
+}
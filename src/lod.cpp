@@ -0,0 +1,317 @@
+#include "lod.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <Tracy.hpp>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+
+#include "render.hpp"
+
+namespace gridviz {
+
+/// The plane's background.  Sparse pixels fade towards it.
+static const uint8_t background_level = 0xff;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - utility
+///////////////////////////////////////////////////////////////////////////////
+
+void drop_lod(Lod_State* lod) {
+    lod->accumulator.drop(cz::heap_allocator());
+}
+
+/// Blend half way from the background to the foreground if the cell has ink.
+static SDL_Color cell_color(const uint8_t fg[3], const uint8_t bg[3], uint8_t ch) {
+    if (is_blank(ch))
+        return {bg[0], bg[1], bg[2], 0xff};
+    return {(uint8_t)((fg[0] + bg[0]) / 2), (uint8_t)((fg[1] + bg[1]) / 2),
+            (uint8_t)((fg[2] + bg[2]) / 2), 0xff};
+}
+
+static int64_t to_pixel(int64_t origin, int64_t cell, double cell_size) {
+    return origin + (int64_t)floor(cell * cell_size);
+}
+
+/// Fill the part of `[x0, x1) x [y0, y1)` that is inside the clip rectangle.  The surface
+/// must be locked if it is in a direct format and unlocked otherwise.
+static void fill_pixels(SDL_Surface* surface,
+                        int64_t x0,
+                        int64_t y0,
+                        int64_t x1,
+                        int64_t y1,
+                        SDL_Color color) {
+    SDL_Rect clip = surface->clip_rect;
+    x0 = cz::max(x0, (int64_t)clip.x);
+    y0 = cz::max(y0, (int64_t)clip.y);
+    x1 = cz::min(x1, (int64_t)clip.x + clip.w);
+    y1 = cz::min(y1, (int64_t)clip.y + clip.h);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    if (!is_direct_format(surface->format)) {
+        SDL_Rect rect = {(int)x0, (int)y0, (int)(x1 - x0), (int)(y1 - y0)};
+        SDL_FillRect(surface, &rect, SDL_MapRGB(surface->format, color.r, color.g, color.b));
+        return;
+    }
+
+    uint32_t color32 = pack_color(surface->format, color);
+    for (int64_t y = y0; y < y1; ++y) {
+        uint32_t* pixels = (uint32_t*)((uint8_t*)surface->pixels + y * surface->pitch);
+        for (int64_t x = x0; x < x1; ++x) {
+            pixels[x] = color32;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - solid cells
+///////////////////////////////////////////////////////////////////////////////
+
+/// Draw each cell as a solid rectangle.  Cells are at least one pixel.
+static void render_cells(SDL_Surface* surface,
+                         const Grid* grid,
+                         const Bounds& visible,
+                         int64_t origin_x,
+                         int64_t origin_y,
+                         double cell_width,
+                         double cell_height) {
+    int64_t width = visible.max_x - visible.min_x + 1;
+    int64_t height = visible.max_y - visible.min_y + 1;
+    for_each_tile(grid, visible.min_x, visible.min_y, width, height, [&](const Tile* tile) {
+        int64_t tile_x = tile->x * tile_size;
+        int64_t tile_y = tile->y * tile_size;
+
+        // Only visit the part of the tile that is visible.
+        int64_t first_row = cz::max(visible.min_y - tile_y, (int64_t)0);
+        int64_t last_row = cz::min(visible.max_y + 1 - tile_y, tile_size);
+        int64_t first_column = cz::max(visible.min_x - tile_x, (int64_t)0);
+        int64_t last_column = cz::min(visible.max_x + 1 - tile_x, tile_size);
+
+        for (int64_t row = first_row; row < last_row; ++row) {
+            uint64_t occupied = tile->occupied[row];
+            if (!occupied)
+                continue;
+
+            int64_t y0 = to_pixel(origin_y, tile_y + row, cell_height);
+            int64_t y1 = to_pixel(origin_y, tile_y + row + 1, cell_height);
+            for (int64_t column = first_column; column < last_column; ++column) {
+                if (!(occupied & ((uint64_t)1 << column)))
+                    continue;
+
+                size_t cell = (size_t)(row * tile_size + column);
+                SDL_Color color = cell_color(tile->fgs[cell], tile->bgs[cell], tile->chars[cell]);
+                int64_t x0 = to_pixel(origin_x, tile_x + column, cell_width);
+                int64_t x1 = to_pixel(origin_x, tile_x + column + 1, cell_width);
+                fill_pixels(surface, x0, y0, x1, y1, color);
+            }
+        }
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - aggregated cells
+///////////////////////////////////////////////////////////////////////////////
+
+/// Once tiles are this many pixels or smaller each tile is drawn as its total.
+static const double tile_summary_pixels = 4;
+
+/// Sums of the summaries that land on each pixel of `rect`.
+struct Accumulator {
+    /// Red, green, blue and weight of each pixel.
+    float* pixels;
+    /// The pixels covered by visible tiles.  Inside the clip rectangle.
+    SDL_Rect rect;
+    int64_t origin_x, origin_y;
+    double cell_width, cell_height;
+};
+
+/// Pixel edges of each summary in a tile.  Every summary covers at least one pixel.
+struct Summary_Edges {
+    int64_t xs[summaries_per_row + 1];
+    int64_t ys[summaries_per_row + 1];
+};
+
+static void get_summary_edges(const Accumulator* acc,
+                              const Tile* tile,
+                              int64_t size,
+                              Summary_Edges* edges) {
+    int64_t count = tile_size / size;
+    for (int64_t i = 0; i <= count; ++i) {
+        edges->xs[i] = to_pixel(acc->origin_x, tile->x * tile_size + i * size, acc->cell_width);
+        edges->ys[i] = to_pixel(acc->origin_y, tile->y * tile_size + i * size, acc->cell_height);
+        if (i > 0) {
+            edges->xs[i] = cz::max(edges->xs[i], edges->xs[i - 1] + 1);
+            edges->ys[i] = cz::max(edges->ys[i], edges->ys[i - 1] + 1);
+        }
+    }
+}
+
+/// Add a summary to the pixels in `[x0, x1) x [y0, y1)`.
+template <class Summary>
+static void accumulate(Accumulator* acc,
+                       const Summary& summary,
+                       int64_t x0,
+                       int64_t y0,
+                       int64_t x1,
+                       int64_t y1) {
+    if (summary.count == 0)
+        return;
+
+    float weight = (float)summary.count / ((x1 - x0) * (y1 - y0));
+
+    const SDL_Rect& rect = acc->rect;
+    x0 = cz::max(x0, (int64_t)rect.x);
+    y0 = cz::max(y0, (int64_t)rect.y);
+    x1 = cz::min(x1, (int64_t)rect.x + rect.w);
+    y1 = cz::min(y1, (int64_t)rect.y + rect.h);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    // Same as `cell_color` but averaged over the summary.  The
+    // weight is folded in so each pixel only needs to add.
+    float scale = weight / summary.count;
+    float ink = (float)summary.ink / summary.count / 2;
+    float color[4];
+    for (int i = 0; i < 3; ++i) {
+        float fg = (float)summary.fg_sums[i];
+        float bg = (float)summary.bg_sums[i];
+        color[i] = (bg + (fg - bg) * ink) * scale;
+    }
+    color[3] = weight;
+
+    for (int64_t y = y0; y < y1; ++y) {
+        float* out = acc->pixels + ((y - rect.y) * rect.w + (x0 - rect.x)) * 4;
+        for (int64_t x = x0; x < x1; ++x, out += 4) {
+            for (int i = 0; i < 4; ++i) {
+                out[i] += color[i];
+            }
+        }
+    }
+}
+
+/// Average the summaries that land on each pixel.  Cells are smaller than a pixel.
+static void render_summaries(Lod_State* lod,
+                             SDL_Surface* surface,
+                             const Grid* grid,
+                             const Bounds& visible,
+                             int64_t origin_x,
+                             int64_t origin_y,
+                             double cell_width,
+                             double cell_height) {
+    SDL_Rect clip = surface->clip_rect;
+    if (clip.w <= 0 || clip.h <= 0)
+        return;
+
+    Accumulator acc;
+    acc.origin_x = origin_x;
+    acc.origin_y = origin_y;
+    acc.cell_width = cell_width;
+    acc.cell_height = cell_height;
+
+    // Far out reading one cache line per tile is much faster than reading every summary.
+    bool whole_tiles = tile_size * cz::max(cell_width, cell_height) <= tile_summary_pixels;
+    int64_t size = (whole_tiles ? tile_size : summary_size);
+    int64_t count = tile_size / size;
+
+    // Only clear and resolve the pixels covered by tiles instead of the whole clip rectangle.
+    int64_t width = visible.max_x - visible.min_x + 1;
+    int64_t height = visible.max_y - visible.min_y + 1;
+    int64_t x0 = clip.x + clip.w, y0 = clip.y + clip.h, x1 = clip.x, y1 = clip.y;
+    for_each_tile(grid, visible.min_x, visible.min_y, width, height, [&](const Tile* tile) {
+        Summary_Edges edges;
+        get_summary_edges(&acc, tile, size, &edges);
+        x0 = cz::min(x0, edges.xs[0]);
+        y0 = cz::min(y0, edges.ys[0]);
+        x1 = cz::max(x1, edges.xs[count]);
+        y1 = cz::max(y1, edges.ys[count]);
+    });
+    x0 = cz::max(x0, (int64_t)clip.x);
+    y0 = cz::max(y0, (int64_t)clip.y);
+    x1 = cz::min(x1, (int64_t)clip.x + clip.w);
+    y1 = cz::min(y1, (int64_t)clip.y + clip.h);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+    acc.rect = {(int)x0, (int)y0, (int)(x1 - x0), (int)(y1 - y0)};
+
+    size_t floats = (size_t)acc.rect.w * acc.rect.h * 4;
+    lod->accumulator.len = 0;
+    lod->accumulator.reserve_exact(cz::heap_allocator(), floats);
+    lod->accumulator.len = floats;
+    memset(lod->accumulator.elems, 0, floats * sizeof(float));
+    acc.pixels = lod->accumulator.elems;
+
+    for_each_tile(grid, visible.min_x, visible.min_y, width, height, [&](const Tile* tile) {
+        Summary_Edges edges;
+        get_summary_edges(&acc, tile, size, &edges);
+        if (whole_tiles) {
+            accumulate(&acc, tile->summary, edges.xs[0], edges.ys[0], edges.xs[1], edges.ys[1]);
+            return;
+        }
+
+        for (int64_t row = 0; row < summaries_per_row; ++row) {
+            for (int64_t column = 0; column < summaries_per_row; ++column) {
+                accumulate(&acc, tile->summaries[row * summaries_per_row + column],
+                           edges.xs[column], edges.ys[row], edges.xs[column + 1],
+                           edges.ys[row + 1]);
+            }
+        }
+    });
+
+    // Each pixel holds `1 / (cell_width * cell_height)` cells.  Pixels
+    // where only some of the cells were drawn fade into the background.
+    float cell_area = (float)(cell_width * cell_height);
+    bool direct = is_direct_format(surface->format);
+    const float* in = acc.pixels;
+    for (int64_t y = y0; y < y1; ++y) {
+        uint32_t* row = (uint32_t*)((uint8_t*)surface->pixels + y * surface->pitch);
+        for (int64_t x = x0; x < x1; ++x, in += 4) {
+            float weight = in[3];
+            if (weight == 0)
+                continue;
+
+            float coverage = cz::min(weight * cell_area, 1.0f);
+            float scale = coverage / weight;
+            float base = background_level * (1 - coverage) + 0.5f;
+            SDL_Color color = {(uint8_t)(base + in[0] * scale), (uint8_t)(base + in[1] * scale),
+                               (uint8_t)(base + in[2] * scale), 0xff};
+
+            if (direct)
+                row[x] = pack_color(surface->format, color);
+            else
+                fill_pixels(surface, x, y, x + 1, y + 1, color);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - render
+///////////////////////////////////////////////////////////////////////////////
+
+void render_grid_lod(Lod_State* lod,
+                     SDL_Surface* surface,
+                     const Grid* grid,
+                     const Bounds& visible,
+                     int64_t origin_x,
+                     int64_t origin_y,
+                     double cell_width,
+                     double cell_height) {
+    ZoneScoped;
+
+    // Other formats are drawn with `SDL_FillRect`, which can't be called while locked.
+    bool lock = is_direct_format(surface->format) && SDL_MUSTLOCK(surface);
+    if (lock)
+        SDL_LockSurface(surface);
+
+    if (cell_width >= 1 && cell_height >= 1) {
+        render_cells(surface, grid, visible, origin_x, origin_y, cell_width, cell_height);
+    } else {
+        render_summaries(lod, surface, grid, visible, origin_x, origin_y, cell_width,
+                         cell_height);
+    }
+
+    if (lock)
+        SDL_UnlockSurface(surface);
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+#include <cz/vector.hpp>
+
+#include "event.hpp"
+#include "grid.hpp"
+
+namespace gridviz {
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/// Below this font size glyphs are unreadable so cells are drawn as solid colors.
+const int min_glyph_font_size = 6;
+
+/// Scratch memory reused between frames.
+struct Lod_State {
+    /// Red, green, blue and weight of each pixel covered by visible tiles.  Kept between
+    /// frames so it is only reallocated when it needs to grow.
+    cz::Vector<float> accumulator;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Function Declarations
+///////////////////////////////////////////////////////////////////////////////
+
+/// Draw the cells of the grid inside `visible` as solid colors.  Each cell is
+/// `cell_width` by `cell_height` pixels.  Once cells are smaller than a pixel
+/// the tiles' summaries are averaged together to get the color of each pixel.
+void render_grid_lod(Lod_State* lod,
+                     SDL_Surface* surface,
+                     const Grid* grid,
+                     const Bounds& visible,
+                     int64_t origin_x,
+                     int64_t origin_y,
+                     double cell_width,
+                     double cell_height);
+
+void drop_lod(Lod_State* lod);
+
+}
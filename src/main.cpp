@@ -1,7 +1,10 @@
 #include <SDL.h>
 #include <SDL_ttf.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <Tracy.hpp>
 #include <cz/buffer_array.hpp>
 #include <cz/date.hpp>
@@ -11,8 +14,15 @@
 
 #include "event.hpp"
 #include "global.hpp"
+#include "grid.hpp"
+#include "keyframes.hpp"
+#include "lod.hpp"
+#include "minimap.hpp"
 #include "render.hpp"
 #include "server.hpp"
+#include "session.hpp"
+#include "timeline.hpp"
+#include "workers.hpp"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -24,6 +34,31 @@ using namespace gridviz;
 
 const int header_height = 40;
 
+/// The parts of the window that need to be redrawn.
+enum Damage_Flags {
+    DAMAGE_HEADER = 1,
+    DAMAGE_PLANE = 2,
+    DAMAGE_TIMELINE = 4,
+    DAMAGE_ALL = DAMAGE_HEADER | DAMAGE_PLANE | DAMAGE_TIMELINE,
+};
+
+/// How long to sleep when there is nothing to draw.  The network thread wakes
+/// us up when data arrives so this only bounds the waiting screen's animation.
+const uint32_t idle_timeout = 1000;
+const uint32_t waiting_animation_timeout = 100;
+
+/// Bands of the plane drawn in parallel are at least this many pixels tall.
+const int min_band_height = 32;
+/// Use more bands than threads so bands with more text don't hold everyone up.
+const size_t bands_per_worker = 4;
+
+/// Lines of the timeline scrolled per notch of the mouse wheel.
+const int timeline_scroll_lines = 3;
+
+/// Zooming further out than this only makes the run a single pixel.
+const float min_zoom = 1.0f / 4096;
+const float max_zoom = 32.0f;
+
 static int get_timeline_width(int window_width) {
     return window_width / 3;
 }
@@ -36,63 +71,186 @@ static void render_timeline_line(Size_Cache* font,
                                  SDL_Color fg,
                                  cz::Str message,
                                  int mode) {
-    int x = text_rect_start->x;
-    int y = text_rect_start->y;
+    // Wrap after the same number of columns as `timeline_entry_lines` assumes.
     int numchars = cz::max(1, (text_rect_end->x - text_rect_start->x) / font->font_width);
-    int width = numchars * font->font_width;
+    int column = 0;
+    int y = text_rect_start->y;
+    const SDL_Rect& clip = surface->clip_rect;
+    auto draw = [&](char ch) {
+        if (column == numchars) {
+            column = 0;
+            y += font->font_height;
+        }
+
+        // Don't bother drawing lines that are scrolled out of view.
+        if (y + font->font_height > clip.y && y < clip.y + clip.h) {
+            char seq[5] = {ch};
+            int x = text_rect_start->x + column * font->font_width;
+            (void)render_code_point(font, surface, x, y, bg, fg, seq);
+        }
+        ++column;
+    };
+
     if (mode >= 0) {
         cz::Str prefix = (mode <= 1 ? "+ " : "  ");
         for (size_t i = 0; i < prefix.len; ++i) {
-            if (x == width) {
-                x = 0;
-                y += font->font_height;
-                text_rect_start->y = y;
-            }
-
-            char seq[5] = {(char)prefix[i]};
-            (void)render_code_point(font, surface, x, y, bg, fg, seq);
-            x += font->font_width;
+            draw(prefix[i]);
         }
     }
     for (size_t i = 0; i < message.len; ++i) {
-        if (x == width) {
-            x = 0;
-            y += font->font_height;
-            text_rect_start->y = y;
-        }
+        draw(message[i]);
+    }
+    text_rect_start->y = y + font->font_height;
+}
+
+/// Find the cells that are inside the clip rectangle.
+static Bounds get_visible_cells(const SDL_Rect& clip,
+                                double cell_width,
+                                double cell_height,
+                                int64_t origin_x,
+                                int64_t origin_y) {
+    Bounds visible;
+    visible.min_x = (int64_t)floor((clip.x - origin_x) / cell_width);
+    visible.min_y = (int64_t)floor((clip.y - origin_y) / cell_height);
+    visible.max_x = (int64_t)floor((clip.x + clip.w - 1 - origin_x) / cell_width);
+    visible.max_y = (int64_t)floor((clip.y + clip.h - 1 - origin_y) / cell_height);
+    return visible;
+}
 
-        char seq[5] = {(char)message[i]};
-        (void)render_code_point(font, surface, x, y, bg, fg, seq);
-        x += font->font_width;
+/// Open the font the plane is drawn with at the run's zoom and get the size of a cell on
+/// screen.  Zoomed out too far for glyphs, cells are drawn as colors scaled from the font
+/// at `base_font_size`.  Otherwise cells are the size of the quantized font.  Sets
+/// `*lod_mode` to which one is used.  Returns null if the font can't be opened.
+static Size_Cache* open_run_font(Font_State* rend,
+                                 const char* font_path,
+                                 const Run_Info* run,
+                                 int base_font_size,
+                                 float dpi_scale,
+                                 bool* lod_mode,
+                                 double* cell_width,
+                                 double* cell_height) {
+    *lod_mode = (int)(run->font_size * dpi_scale) < min_glyph_font_size;
+    int font_size = (*lod_mode ? base_font_size : run->font_size);
+    Size_Cache* font = open_font(rend, font_path, (int)(font_size * dpi_scale));
+    if (!font)
+        return nullptr;
+
+    *cell_width = font->font_width;
+    *cell_height = font->font_height;
+    if (*lod_mode) {
+        *cell_width *= run->zoom;
+        *cell_height *= run->zoom;
     }
-    text_rect_start->y += font->font_height;
+    return font;
 }
 
-static bool find_matching_stroke(cz::Slice<SDL_Rect> the_stroke_rects,
-                                 SDL_Point point,
-                                 size_t* index) {
-    for (size_t i = 0; i < the_stroke_rects.len; ++i) {
-        SDL_Rect rect = the_stroke_rects[i];
-        if (SDL_PointInRect(&point, &rect)) {
-            *index = i;
-            return true;
+/// Draw every cell of the grid that is inside `visible` exactly once.  If `table`
+/// isn't null then glyphs are only read from it and the surface must be locked.
+static void render_grid(Size_Cache* font,
+                        const Glyph_Table* table,
+                        SDL_Surface* surface,
+                        const SDL_Rect& clip,
+                        const Grid* grid,
+                        const Bounds& visible,
+                        int64_t origin_x,
+                        int64_t origin_y) {
+    int64_t start_x = visible.min_x;
+    int64_t start_y = visible.min_y;
+    int64_t end_x = visible.max_x + 1;
+    int64_t end_y = visible.max_y + 1;
+
+    for_each_tile(grid, start_x, start_y, end_x - start_x, end_y - start_y, [&](const Tile* tile) {
+        int64_t tile_x = tile->x * tile_size;
+        int64_t tile_y = tile->y * tile_size;
+
+        // Only visit the part of the tile that is visible.
+        int64_t first_row = cz::max(start_y - tile_y, (int64_t)0);
+        int64_t last_row = cz::min(end_y - tile_y, tile_size);
+        int64_t first_column = cz::max(start_x - tile_x, (int64_t)0);
+        int64_t last_column = cz::min(end_x - tile_x, tile_size);
+
+        // Draw each row of the tile at once.
+        Cell cells[tile_size];
+        for (int64_t row = first_row; row < last_row; ++row) {
+            uint64_t occupied = tile->occupied[row];
+            size_t count = 0;
+            for (int64_t column = first_column; column < last_column; ++column) {
+                if (!(occupied & ((uint64_t)1 << column)))
+                    continue;
+
+                size_t cell = (size_t)(row * tile_size + column);
+                Cell* out = &cells[count++];
+                out->px = (tile_x + column) * font->font_width + origin_x;
+                out->foreground = {tile->fgs[cell][0], tile->fgs[cell][1], tile->fgs[cell][2]};
+                out->background = {tile->bgs[cell][0], tile->bgs[cell][1], tile->bgs[cell][2]};
+                memset(out->seq, 0, sizeof(out->seq));
+                out->seq[0] = (char)tile->chars[cell];
+            }
+
+            int64_t y = (tile_y + row) * font->font_height + origin_y;
+            if (table) {
+                render_cell_row_shared(font, table, surface, clip, y, {cells, count});
+            } else {
+                render_cell_row(font, surface, y, {cells, count});
+            }
         }
-    }
+    });
+}
+
+/// Find the bytes drawn by the cells inside `visible`.
+static void mark_used_glyphs(const Grid* grid, const Bounds& visible, bool used[256]) {
+    int64_t width = visible.max_x - visible.min_x + 1;
+    int64_t height = visible.max_y - visible.min_y + 1;
+    for_each_tile(grid, visible.min_x, visible.min_y, width, height, [&](const Tile* tile) {
+        for (int64_t row = 0; row < tile_size; ++row) {
+            uint64_t occupied = tile->occupied[row];
+            for (int64_t column = 0; occupied; ++column, occupied >>= 1) {
+                if (occupied & 1)
+                    used[tile->chars[row * tile_size + column]] = true;
+            }
+        }
+    });
+}
 
-    if (the_stroke_rects.len == 0)
-        return false;
+/// Split the clip rectangle into horizontal bands and draw them in parallel.  Every
+/// glyph is rasterized up front so the workers only read the atlas.
+static void render_grid_bands(Worker_Pool* workers,
+                              Size_Cache* font,
+                              SDL_Surface* surface,
+                              const Grid* grid,
+                              const Bounds& visible,
+                              int64_t origin_x,
+                              int64_t origin_y) {
+    ZoneScoped;
 
-    // If flick up or down fast then recognize that.
-    if (point.x < the_stroke_rects[0].y) {
-        *index = 0;
-        return true;
-    }
-    if (point.y > the_stroke_rects.last().y + the_stroke_rects.last().h) {
-        *index = the_stroke_rects.len;
-        return true;
+    SDL_Rect clip = surface->clip_rect;
+    size_t bands = cz::min(worker_count(workers) * bands_per_worker,
+                           (size_t)cz::max(clip.h / min_band_height, 1));
+    if (worker_count(workers) == 1 || bands <= 1 || !is_direct_format(surface->format)) {
+        render_grid(font, nullptr, surface, clip, grid, visible, origin_x, origin_y);
+        return;
     }
 
-    return false;
+    bool used[256] = {};
+    mark_used_glyphs(grid, visible, used);
+    Glyph_Table table;
+    prepare_glyph_table(font, used, &table);
+
+    if (SDL_MUSTLOCK(surface))
+        SDL_LockSurface(surface);
+
+    run_parallel(workers, bands, [&](size_t band) {
+        ZoneScopedN("render_grid_band");
+        int start_y = clip.y + (int)(clip.h * band / bands);
+        int end_y = clip.y + (int)(clip.h * (band + 1) / bands);
+        SDL_Rect band_clip = {clip.x, start_y, clip.w, end_y - start_y};
+        Bounds band_visible = get_visible_cells(band_clip, font->font_width, font->font_height,
+                                                origin_x, origin_y);
+        render_grid(font, &table, surface, band_clip, grid, band_visible, origin_x, origin_y);
+    });
+
+    if (SDL_MUSTLOCK(surface))
+        SDL_UnlockSurface(surface);
 }
 
 int actual_main(int argc, char** argv) {
@@ -109,10 +267,52 @@ int actual_main(int argc, char** argv) {
     set_program_name(argv[0]);
     set_program_directory();
 
+    // Every run is recorded so it can be looked at again with `--open`.
+    cz::Vector<const char*> open_paths = {};
+    CZ_DEFER(open_paths.drop(cz::heap_allocator()));
+    bool record = true;
+    // Defaults to the user's data directory once SDL is initialized.
+    const char* record_directory = nullptr;
+    size_t session_memory_budget = default_session_memory_budget;
+    bool has_memory_budget = false;
+    for (int i = 1; i < argc; ++i) {
+        cz::Str arg = argv[i];
+        if (arg == "--open" && i + 1 < argc) {
+            open_paths.reserve(cz::heap_allocator(), 1);
+            open_paths.push(argv[++i]);
+        } else if (arg == "--record" && i + 1 < argc) {
+            record = true;
+            record_directory = argv[++i];
+        } else if (arg == "--no-record") {
+            record = false;
+            record_directory = nullptr;
+        } else if (arg == "--memory-budget" && i + 1 < argc) {
+            session_memory_budget = (size_t)strtoull(argv[++i], nullptr, 10) << 20;
+            has_memory_budget = true;
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--open FILE]... [--record DIRECTORY | --no-record] "
+                    "[--memory-budget MEGABYTES]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (has_memory_budget && !record) {
+        fprintf(stderr,
+                "Warning: --memory-budget has no effect on received runs with --no-record "
+                "because only recorded strokes can be dropped from memory\n");
+    }
+
     Font_State rend = {};
+    rend.memory_budget = default_font_memory_budget;
+    Lod_State lod = {};
+    CZ_DEFER(drop_lod(&lod));
     Network_State* net = nullptr;
     Game_State game = {};
+    CZ_DEFER(finish_sessions(&game));
 
+    int run_font_size = 14;
     int menu_font_size = 14;
     int wfc_font_size = 20;
     int header_font_size = 14;
@@ -128,6 +328,24 @@ int actual_main(int argc, char** argv) {
     }
     CZ_DEFER(SDL_Quit());
 
+    if (record && !record_directory) {
+        char* pref_path = SDL_GetPrefPath("", "gridviz");
+        if (pref_path) {
+            // Paths are joined with a separator so drop the trailing one.
+            cz::Str directory = pref_path;
+            char last = (directory.len > 1 ? directory.buffer[directory.len - 1] : 0);
+            if (last == '/' || last == '\\')
+                directory.len--;
+            record_directory = directory.clone_null_terminate(permanent_allocator).buffer;
+            SDL_free(pref_path);
+        } else {
+            fprintf(stderr, "SDL_GetPrefPath failed: %s\n", SDL_GetError());
+            record_directory = ".";
+        }
+    }
+    if (record)
+        printf("Recording runs to %s\n", record_directory);
+
     float dpi_scale = 1.0f;
     {
         const float dpi_default = 96.0f;
@@ -157,43 +375,75 @@ int actual_main(int argc, char** argv) {
     }
     CZ_DEFER(SDL_DestroyWindow(window));
 
+    for (size_t i = 0; i < open_paths.len; ++i) {
+        if (!open_session(&game, open_paths[i]))
+            return 1;
+    }
+
     net = start_networking(port);
+    // Runs after the loop but before `finish_sessions` so everything received gets recorded.
+    CZ_DEFER({
+        stop_networking(net, &game);
+        if (record_directory)
+            record_sessions(&game, record_directory);
+    });
+
+    Keyframe_State* keyframes = start_keyframes();
+    CZ_DEFER(stop_keyframes(keyframes));
+
+    Worker_Pool* workers = start_workers(default_worker_count());
+    CZ_DEFER(stop_workers(workers));
 
     int dragging = 0;
-    cz::Vector<SDL_Rect> the_stroke_rects = {};
+    // Selecting strokes is done once per frame no matter how many times the mouse moved.
+    bool select_stroke = false;
+    int select_stroke_y = 0;
+    Minimap_Layout minimap_layout = {};
     Run_Info* previously_selected_run = NULL;
 
-    CZ_DEFER(the_stroke_rects.drop(cz::heap_allocator()));
+    uint32_t damage = DAMAGE_ALL;
+    uint32_t waiting_ticks = 0;
 
     while (1) {
-        uint32_t start_frame = SDL_GetTicks();
-
         Run_Info* the_run =
             (game.selected_run < game.runs.len ? &game.runs[game.selected_run] : NULL);
 
-        if (previously_selected_run != the_run) {
-            previously_selected_run = the_run;
-            // Selection changed.
-            dragging = 0;
-            the_stroke_rects.len = 0;
+        // Block until something happens if there is nothing to redraw.
+        SDL_Event event;
+        int has_event;
+        if (damage) {
+            has_event = SDL_PollEvent(&event);
+        } else {
+            has_event = SDL_WaitEventTimeout(
+                &event, the_run ? idle_timeout : waiting_animation_timeout);
         }
 
-        for (SDL_Event event; SDL_PollEvent(&event);) {
+        uint32_t start_frame = SDL_GetTicks();
+
+        for (; has_event; has_event = SDL_PollEvent(&event)) {
             switch (event.type) {
             case SDL_QUIT:
                 return 0;
 
+            case SDL_WINDOWEVENT:
+                // The surface may have been resized or lost its contents.
+                damage = DAMAGE_ALL;
+                break;
+
             case SDL_MOUSEBUTTONDOWN:
                 if (event.button.button == SDL_BUTTON_LEFT && the_run) {
                     int window_width;
                     SDL_GetWindowSize(window, &window_width, nullptr);
-                    if (event.button.x > get_timeline_width(window_width)) {
+                    SDL_Point point = {event.button.x, event.button.y};
+                    if (minimap_jump(minimap_layout, point, &the_run->off_x, &the_run->off_y)) {
+                        dragging = 3;
+                        damage |= DAMAGE_PLANE;
+                    } else if (event.button.x > get_timeline_width(window_width)) {
                         dragging = 1;
                     } else {
                         // Select a new stroke.
-                        SDL_Point point = {event.button.x, event.button.y};
-                        (void)find_matching_stroke(the_stroke_rects, point,
-                                                   &the_run->selected_stroke);
+                        select_stroke = true;
+                        select_stroke_y = event.button.y;
                         dragging = 2;
                     }
                 }
@@ -211,11 +461,18 @@ int actual_main(int argc, char** argv) {
                         // Panning.
                         the_run->off_x += event.motion.xrel;
                         the_run->off_y += event.motion.yrel;
+                        damage |= DAMAGE_PLANE;
                     } else if (the_run && dragging == 2) {
                         // Selecting stroke.
+                        select_stroke = true;
+                        select_stroke_y = event.motion.y;
+                    } else if (the_run && dragging == 3) {
+                        // Moving around the minimap.
                         SDL_Point point = {event.motion.x, event.motion.y};
-                        (void)find_matching_stroke(the_stroke_rects, point,
-                                                   &the_run->selected_stroke);
+                        if (minimap_jump(minimap_layout, point, &the_run->off_x,
+                                         &the_run->off_y)) {
+                            damage |= DAMAGE_PLANE;
+                        }
                     }
                 }
                 break;
@@ -231,36 +488,59 @@ int actual_main(int argc, char** argv) {
                 event.wheel.x *= -1;
 #endif
 
-                if (the_run) {
-                    float old_zoom = the_run->zoom;
+                int mouse_x = 0, mouse_y = 0, window_width = 0;
+                SDL_GetMouseState(&mouse_x, &mouse_y);
+                SDL_GetWindowSize(window, &window_width, nullptr);
+
+                if (the_run && the_run->timeline && mouse_x < get_timeline_width(window_width)) {
+                    // Scroll the timeline.
+                    Timeline* timeline = the_run->timeline;
+                    timeline->scroll -=
+                        (int64_t)event.wheel.y * timeline_scroll_lines * timeline->line_height;
+                    clamp_timeline_scroll(timeline);
+                    damage |= DAMAGE_TIMELINE;
+                } else if (the_run) {
+                    // Font sizes are quantized so the cells don't grow by exactly the zoom.
+                    bool old_lod, new_lod;
+                    double old_width, old_height, new_width, new_height;
+                    if (!open_run_font(&rend, font_path, the_run, run_font_size, dpi_scale,
+                                       &old_lod, &old_width, &old_height)) {
+                        fprintf(stderr, "TTF_OpenFont failed: %s\n", SDL_GetError());
+                        return 1;
+                    }
+
                     if (event.wheel.y < 0) {
                         // Scroll down - zoom out.
-                        the_run->zoom /= 1.25f;
+                        the_run->zoom = cz::max(the_run->zoom / 1.25f, min_zoom);
                     } else if (event.wheel.y > 0) {
                         // Scroll up - zoom in.
-                        the_run->zoom *= 1.25f;
+                        the_run->zoom = cz::min(the_run->zoom * 1.25f, max_zoom);
+                    }
+                    the_run->font_size = (int)(run_font_size * the_run->zoom);
+
+                    if (!open_run_font(&rend, font_path, the_run, run_font_size, dpi_scale,
+                                       &new_lod, &new_width, &new_height)) {
+                        fprintf(stderr, "TTF_OpenFont failed: %s\n", SDL_GetError());
+                        return 1;
                     }
-                    float new_zoom = the_run->zoom;
-                    the_run->font_size = (int)(14 * the_run->zoom);
 
                     //
-                    // Zoom around the mouse.  Note: the offsets are at the current zoom level.
+                    // Zoom around the mouse.  Note: the offsets are in pixels at the
+                    // current cell size.
                     //
 
                     // Get mouse position in the plane.
-                    int mouse_x = 0, mouse_y = 0, window_width = 0;
-                    SDL_GetMouseState(&mouse_x, &mouse_y);
-                    SDL_GetWindowSize(window, &window_width, nullptr);
                     int64_t m2_x = mouse_x - get_timeline_width(window_width);
                     int64_t m2_y = mouse_y - header_height;
 
                     // Make the mouse the origin then zoom then revert.
                     the_run->off_x -= m2_x;
                     the_run->off_y -= m2_y;
-                    the_run->off_x *= new_zoom / old_zoom;
-                    the_run->off_y *= new_zoom / old_zoom;
+                    the_run->off_x = (int64_t)(the_run->off_x * (new_width / old_width));
+                    the_run->off_y = (int64_t)(the_run->off_y * (new_height / old_height));
                     the_run->off_x += m2_x;
                     the_run->off_y += m2_y;
+                    damage |= DAMAGE_PLANE;
                 }
             } break;
 
@@ -281,6 +561,10 @@ int actual_main(int argc, char** argv) {
                     if (the_run->selected_stroke < the_run->strokes.len)
                         the_run->selected_stroke++;
                 }
+                if ((event.key.keysym.sym == SDLK_UP || event.key.keysym.sym == SDLK_DOWN) &&
+                    the_run) {
+                    damage |= DAMAGE_PLANE | DAMAGE_TIMELINE;
+                }
 
                 // Set selected run.
                 if (event.key.keysym.sym == SDLK_LEFT) {
@@ -290,7 +574,7 @@ int actual_main(int argc, char** argv) {
                         (game.selected_run < game.runs.len ? &game.runs[game.selected_run] : NULL);
                     // Selection changed.
                     dragging = false;
-                    the_stroke_rects.len = 0;
+                    select_stroke = false;
                 }
                 if (event.key.keysym.sym == SDLK_RIGHT) {
                     if (game.selected_run < game.runs.len)
@@ -299,30 +583,73 @@ int actual_main(int argc, char** argv) {
                         (game.selected_run < game.runs.len ? &game.runs[game.selected_run] : NULL);
                     // Selection changed.
                     dragging = false;
-                    the_stroke_rects.len = 0;
+                    select_stroke = false;
                 }
 
                 // Reset offset.
                 if (event.key.keysym.sym == SDLK_0 && the_run) {
                     the_run->off_x = 10;
                     the_run->off_y = 10;
+                    damage |= DAMAGE_PLANE;
                 }
 
                 break;
             }
         }
 
-        poll_network(net, &game);
+        // Only the last position the mouse was dragged to matters.
+        if (select_stroke) {
+            select_stroke = false;
+            size_t index;
+            if (the_run && the_run->timeline &&
+                find_stroke_at(the_run->timeline, select_stroke_y, &index) &&
+                index != the_run->selected_stroke) {
+                the_run->selected_stroke = index;
+                damage |= DAMAGE_PLANE | DAMAGE_TIMELINE;
+            }
+        }
+
+        if (poll_network(net, &game))
+            damage |= DAMAGE_PLANE | DAMAGE_TIMELINE;
+        poll_keyframes(keyframes, &game);
+        if (record_directory)
+            record_sessions(&game, record_directory);
+
+        // Receiving a new run or pressing left or right changes the selected run.
+        the_run = (game.selected_run < game.runs.len ? &game.runs[game.selected_run] : NULL);
+        if (previously_selected_run != the_run) {
+            previously_selected_run = the_run;
+            // Selection changed.
+            dragging = 0;
+            select_stroke = false;
+            minimap_layout = {};
+            damage = DAMAGE_ALL;
+        }
+
+        // Keep the minimap up to date with the strokes that were received.
+        if (the_run && update_minimap(the_run))
+            damage |= DAMAGE_PLANE;
+
+        // Animate the waiting for connection screen.
+        if (!the_run) {
+            uint32_t ticks = SDL_GetTicks() % 2000 / 667;
+            if (ticks != waiting_ticks) {
+                waiting_ticks = ticks;
+                damage |= DAMAGE_PLANE;
+            }
+        }
+
+        if (!damage)
+            continue;
 
         SDL_Surface* surface = SDL_GetWindowSurface(window);
-        SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0xff, 0xff, 0xff));
 
         int timeline_width = get_timeline_width(surface->w);
 
         /////////////////////////////////////////
         // Header
         /////////////////////////////////////////
-        {
+        if (damage & DAMAGE_HEADER) {
             // Color constants.
             const SDL_Color bg = {0xbb, 0xbb, 0xbb};
             const SDL_Color fg = {0x00, 0x00, 0x00};
@@ -375,9 +702,12 @@ int actual_main(int argc, char** argv) {
         /////////////////////////////////////////
         // Main plane
         /////////////////////////////////////////
-        if (the_run) {
-            Size_Cache* run_font =
-                open_font(&rend, font_path, (int)(the_run->font_size * dpi_scale));
+        if (the_run && (damage & DAMAGE_PLANE)) {
+            // When zoomed far out the glyphs are unreadable so draw colors instead.
+            bool lod_mode;
+            double cell_width, cell_height;
+            Size_Cache* run_font = open_run_font(&rend, font_path, the_run, run_font_size,
+                                                 dpi_scale, &lod_mode, &cell_width, &cell_height);
             if (!run_font) {
                 fprintf(stderr, "TTF_OpenFont failed: %s\n", SDL_GetError());
                 return 1;
@@ -386,31 +716,21 @@ int actual_main(int argc, char** argv) {
             SDL_Rect plane_rect = {timeline_width, header_height, surface->w - timeline_width,
                                    surface->h - header_height};
             SDL_SetClipRect(surface, &plane_rect);
-
-            for (size_t s = 0; s < cz::min(the_run->strokes.len, the_run->selected_stroke + 1);
-                 ++s) {
-                Stroke* stroke = &the_run->strokes[s];
-                for (size_t i = 0; i < stroke->events.len; ++i) {
-                    Event& event = stroke->events[i];
-                    switch (event.type) {
-                    case EVENT_CHAR_POINT: {
-                        int64_t x = event.cp.x * run_font->font_width + the_run->off_x;
-                        int64_t y = event.cp.y * run_font->font_height + the_run->off_y;
-                        x += timeline_width;
-                        y += header_height;
-
-                        SDL_Color bg = {event.cp.bg[0], event.cp.bg[1], event.cp.bg[2]};
-                        SDL_Color fg = {event.cp.fg[0], event.cp.fg[1], event.cp.fg[2]};
-
-                        char seq[5] = {(char)event.cp.ch};
-                        (void)render_code_point(run_font, surface, x, y, bg, fg, seq);
-                    } break;
-
-                    default:
-                        CZ_DEBUG_ASSERT(false);  // Ignore in release mode.
-                        break;
-                    }
-                }
+            SDL_FillRect(surface, &plane_rect, SDL_MapRGB(surface->format, 0xff, 0xff, 0xff));
+
+            int64_t origin_x = timeline_width + the_run->off_x;
+            int64_t origin_y = header_height + the_run->off_y;
+
+            // Only draw the final state of each visible cell.
+            size_t end = cz::min(the_run->strokes.len, the_run->selected_stroke + 1);
+            Bounds visible =
+                get_visible_cells(surface->clip_rect, cell_width, cell_height, origin_x, origin_y);
+            const Grid* grid = resolve_grid(the_run, end, visible);
+            if (lod_mode) {
+                render_grid_lod(&lod, surface, grid, visible, origin_x, origin_y, cell_width,
+                                cell_height);
+            } else {
+                render_grid_bands(workers, run_font, surface, grid, visible, origin_x, origin_y);
             }
 
             // Draw axes.
@@ -423,12 +743,15 @@ int actual_main(int argc, char** argv) {
             uint32_t axis_color32 = SDL_MapRGB(surface->format, 0x88, 0x88, 0x88);
             SDL_FillRect(surface, &axis_x, axis_color32);
             SDL_FillRect(surface, &axis_y, axis_color32);
+
+            render_minimap(surface, the_run->minimap, plane_rect, dpi_scale, visible, cell_width,
+                           cell_height, &minimap_layout);
         }
 
         /////////////////////////////////////////
         // Timeline
         /////////////////////////////////////////
-        if (the_run) {
+        if (the_run && (damage & DAMAGE_TIMELINE)) {
             // Color constants.
             const SDL_Color bg = {0xdd, 0xdd, 0xdd};
             const SDL_Color fg_selected = {0x00, 0x00, 0xd7};
@@ -468,8 +791,31 @@ int actual_main(int argc, char** argv) {
             text_rect_start.y += 2;  // account for horline
             text_rect_start.y += 4;  // add some padding
 
-            the_stroke_rects.len = 0;
-            for (size_t i = 0; i < the_run->strokes.len; ++i) {
+            // Only the strokes that are scrolled into view are drawn.
+            SDL_Rect list_rect = {bar_rect.x, text_rect_start.y, bar_rect.w,
+                                  bar_rect.y + bar_rect.h - text_rect_start.y};
+            SDL_SetClipRect(surface, &list_rect);
+
+            int columns = (text_rect_end.x - text_rect_start.x) / menu_font->font_width;
+            Timeline* timeline = update_timeline(the_run, columns);
+            timeline->line_height = menu_font->font_height;
+            timeline->view_top = list_rect.y;
+            timeline->view_height = list_rect.h;
+
+            // Follow the selection but let the user scroll away from it.
+            if (timeline->scrolled_to != the_run->selected_stroke) {
+                timeline->scrolled_to = the_run->selected_stroke;
+                scroll_to_entry(timeline, the_run->selected_stroke);
+            }
+            clamp_timeline_scroll(timeline);
+
+            int64_t list_top = list_rect.y - timeline->scroll;
+            size_t first = find_timeline_entry(timeline, timeline->scroll);
+            for (size_t i = first; i < the_run->strokes.len; ++i) {
+                int64_t top = timeline_entry_top(timeline, i);
+                if (top >= timeline->scroll + timeline->view_height)
+                    break;
+
                 Stroke* stroke = &the_run->strokes[i];
                 SDL_Color fg = fg_ignored;
                 int mode = 2;
@@ -481,16 +827,10 @@ int actual_main(int argc, char** argv) {
                     fg = fg_applied;
                     mode = 0;
                 }
-                SDL_Rect stroke_rect = {text_rect_start.x, text_rect_start.y - 2,
-                                        bar_rect.w - padding * 2, 0};
-
+                text_rect_start.y = (int)(list_top + top);
                 render_timeline_line(menu_font, surface, &text_rect_start, &text_rect_end, bg, fg,
                                      stroke->title, mode);
 
-                stroke_rect.h = text_rect_start.y - stroke_rect.y + 2 * 2;
-                the_stroke_rects.reserve(cz::heap_allocator(), 1);
-                the_stroke_rects.push(stroke_rect);
-
                 // Draw horizontal divider after the title.
                 text_rect_start.y += 2;  // add some padding
                 SDL_Rect horline = {bar_rect.x + padding, text_rect_start.y,
@@ -498,15 +838,13 @@ int actual_main(int argc, char** argv) {
                 SDL_FillRect(
                     surface, &horline,
                     SDL_MapRGB(surface->format, horline_color.r, horline_color.g, horline_color.b));
-                text_rect_start.y += 1;  // account for horline
-                text_rect_start.y += 2;  // add some padding
             }
         }
 
         /////////////////////////////////////////
         // Waiting for connection screen
         /////////////////////////////////////////
-        if (!the_run) {
+        if (!the_run && (damage & (DAMAGE_PLANE | DAMAGE_TIMELINE))) {
             const SDL_Color bg = {0xdd, 0xdd, 0xdd};
             const SDL_Color fg = {0x00, 0x00, 0x00};
 
@@ -518,6 +856,7 @@ int actual_main(int argc, char** argv) {
 
             SDL_Rect plane_rect = {0, header_height, surface->w, surface->h - header_height};
             SDL_SetClipRect(surface, &plane_rect);
+            SDL_FillRect(surface, &plane_rect, SDL_MapRGB(surface->format, 0xff, 0xff, 0xff));
 
             cz::Str message1 = "WAITING FOR CONNECTION";
             cz::Str message2 = "...";
@@ -549,7 +888,7 @@ int actual_main(int argc, char** argv) {
             {
                 int64_t x = (surface->w - menu_font->font_width * message2.len) / 2;
                 int64_t y = surface->h / 2;
-                int numticks = (SDL_GetTicks() % 2000 / 667 + 1);
+                int numticks = waiting_ticks + 1;
                 for (size_t i = 0; i < numticks; ++i) {
                     char seq[5] = {(char)message2[i]};
                     (void)render_code_point(menu_font, surface, x, y, bg, fg, seq);
@@ -559,7 +898,30 @@ int actual_main(int argc, char** argv) {
         }
 
         SDL_SetClipRect(surface, nullptr);
-        SDL_UpdateWindowSurface(window);
+
+        // Only present the parts of the window that were redrawn.
+        SDL_Rect rects[3];
+        int num_rects = 0;
+        if (damage & DAMAGE_HEADER) {
+            rects[num_rects++] = {0, 0, surface->w, header_height};
+        }
+        if (!the_run) {
+            if (damage & (DAMAGE_PLANE | DAMAGE_TIMELINE))
+                rects[num_rects++] = {0, header_height, surface->w, surface->h - header_height};
+        } else {
+            if (damage & DAMAGE_TIMELINE)
+                rects[num_rects++] = {0, header_height, timeline_width, surface->h - header_height};
+            if (damage & DAMAGE_PLANE) {
+                rects[num_rects++] = {timeline_width, header_height, surface->w - timeline_width,
+                                      surface->h - header_height};
+            }
+        }
+        SDL_UpdateWindowSurfaceRects(window, rects, num_rects);
+        damage = 0;
+
+        // The fonts opened this frame are no longer in use.
+        trim_fonts(&rend);
+        trim_sessions(&game, session_memory_budget);
 
         const uint32_t frame_length = 1000 / 60;
         uint32_t wanted_end = start_frame + frame_length;
@@ -0,0 +1,366 @@
+#include "minimap.hpp"
+
+#include <math.h>
+#include <Tracy.hpp>
+#include <cz/binary_search.hpp>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+
+#include "session.hpp"
+
+namespace gridviz {
+
+static void update_tile(Minimap* minimap, const Tile* tile, bool* changed);
+
+/// Largest size of the minimap in pixels before scaling by the dpi.
+static const int minimap_size = 200;
+static const int minimap_margin = 10;
+/// Texels are drawn at least this many pixels wide so there are few of them.
+static const double min_texel_pixels = 2;
+/// Sparse texels are drawn at least this dark so they don't disappear.
+static const float min_coverage = 0.25f;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - lifetime
+///////////////////////////////////////////////////////////////////////////////
+
+void drop_minimap(Minimap* minimap) {
+    drop_grid(&minimap->grid);
+    for (int level = 0; level < minimap_levels; ++level) {
+        minimap->levels[level].drop(cz::heap_allocator());
+    }
+    minimap->dirty.drop(cz::heap_allocator());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - updating
+///////////////////////////////////////////////////////////////////////////////
+
+static Bounds segment_bounds(const Stroke* stroke, const Segment& segment) {
+    if (segment.type == SEGMENT_CHUNK) {
+        const Chunk& chunk = stroke->chunks[segment.index];
+        return {chunk.x + chunk.min_dx, chunk.y + chunk.min_dy, chunk.x + chunk.max_dx,
+                chunk.y + chunk.max_dy};
+    } else {
+        const Block& block = stroke->blocks[segment.index];
+        return {block.x, block.y, block.x + (int64_t)block.width - 1,
+                block.y + (int64_t)block.height - 1};
+    }
+}
+
+/// Apply the segments `[start, end)` and remember where they drew.
+static void apply_dirty_segments(Minimap* minimap,
+                                 const Stroke* stroke,
+                                 size_t start,
+                                 size_t end,
+                                 const Color_Pair* palette) {
+    apply_segments(&minimap->grid, stroke, start, end, palette, nullptr);
+    minimap->dirty.reserve(cz::heap_allocator(), end - start);
+    for (size_t i = start; i < end; ++i) {
+        minimap->dirty.push(segment_bounds(stroke, stroke->segments[i]));
+    }
+}
+
+/// Fork from the newest keyframe and replay up to the same point.  The cells don't
+/// change so the pyramid doesn't either but the tiles copied since then are freed.
+static void restart_from_keyframe(Minimap* minimap, Run_Info* run, const Keyframe* keyframe) {
+    drop_grid(&minimap->grid);
+    fork_grid(&minimap->grid, &keyframe->grid);
+    minimap->keyframe_stroke = keyframe->stroke;
+
+    for (size_t i = keyframe->stroke; i < minimap->stroke; ++i) {
+        load_stroke(run, i);
+        const Stroke* stroke = &run->strokes[i];
+        size_t end = (i + 1 == minimap->stroke ? minimap->segment : stroke->segments.len);
+        apply_segments(&minimap->grid, stroke, 0, end, run->palette.elems, nullptr);
+    }
+}
+
+/// Skip ahead to a keyframe after the strokes that were applied.  Tiles are copied
+/// on write so only the tiles that aren't shared with the old grid have changed.
+static void jump_to_keyframe(Minimap* minimap,
+                             Run_Info* run,
+                             const Keyframe* keyframe,
+                             bool* changed) {
+    Grid old_grid = minimap->grid;
+    fork_grid(&minimap->grid, &keyframe->grid);
+    minimap->keyframe_stroke = keyframe->stroke;
+    minimap->stroke = keyframe->stroke;
+    load_stroke(run, keyframe->stroke - 1);
+    minimap->segment = run->strokes[keyframe->stroke - 1].segments.len;
+
+    for (size_t i = 0; i < minimap->grid.tiles.len; ++i) {
+        const Tile* tile = minimap->grid.tiles[i];
+        size_t index = find_tile(&old_grid, tile->x, tile->y);
+        if (index < old_grid.tiles.len && old_grid.tiles[index] == tile)
+            continue;
+        update_tile(minimap, tile, changed);
+    }
+    drop_grid(&old_grid);
+}
+
+bool update_minimap(Run_Info* run) {
+    ZoneScoped;
+
+    if (!run->minimap) {
+        run->minimap = cz::heap_allocator().alloc<Minimap>();
+        *run->minimap = {};
+    }
+
+    Minimap* minimap = run->minimap;
+    const Color_Pair* palette = run->palette.elems;
+    Keyframe* keyframe = (run->keyframes.len > 0 ? run->keyframes.last() : nullptr);
+    bool changed = false;
+
+    if (!minimap->valid) {
+        fork_grid(&minimap->grid, keyframe ? &keyframe->grid : nullptr);
+        minimap->valid = true;
+        minimap->tile_bounds = empty_bounds();
+        minimap->keyframe_stroke = (keyframe ? keyframe->stroke : 0);
+        minimap->stroke = minimap->keyframe_stroke;
+        // Keyframes only contain completed strokes.
+        if (minimap->stroke > 0)
+            load_stroke(run, minimap->stroke - 1);
+        minimap->segment =
+            (minimap->stroke > 0 ? run->strokes[minimap->stroke - 1].segments.len : 0);
+
+        for (size_t i = 0; i < minimap->grid.tiles.len; ++i) {
+            update_tile(minimap, minimap->grid.tiles[i], &changed);
+        }
+    } else if (keyframe && keyframe->stroke > minimap->stroke) {
+        jump_to_keyframe(minimap, run, keyframe, &changed);
+    } else if (keyframe && keyframe->stroke > minimap->keyframe_stroke) {
+        restart_from_keyframe(minimap, run, keyframe);
+    }
+
+    // Sessions that were opened follow the keyframes instead of reading every stroke.
+    // The strokes after the last keyframe are read once the keyframes are all built.
+    size_t end = run->strokes.len;
+    if (run->session && run->session->reading && run->keyframe_pending)
+        end = minimap->stroke;
+
+    // The last stroke we applied may have grown since.
+    if (minimap->stroke > 0) {
+        load_stroke(run, minimap->stroke - 1);
+        const Stroke* stroke = &run->strokes[minimap->stroke - 1];
+        apply_dirty_segments(minimap, stroke, minimap->segment, stroke->segments.len, palette);
+        minimap->segment = stroke->segments.len;
+    }
+
+    for (; minimap->stroke < end; ++minimap->stroke) {
+        load_stroke(run, minimap->stroke);
+        const Stroke* stroke = &run->strokes[minimap->stroke];
+        apply_dirty_segments(minimap, stroke, 0, stroke->segments.len, palette);
+        minimap->segment = stroke->segments.len;
+    }
+
+    // Only look at the tiles that were drawn to.
+    for (size_t i = 0; i < minimap->dirty.len; ++i) {
+        const Bounds& dirty = minimap->dirty[i];
+        for_each_tile(&minimap->grid, dirty.min_x, dirty.min_y, dirty.max_x - dirty.min_x + 1,
+                      dirty.max_y - dirty.min_y + 1,
+                      [&](const Tile* tile) { update_tile(minimap, tile, &changed); });
+    }
+    minimap->dirty.len = 0;
+
+    return changed;
+}
+
+static int64_t compare_texels(const Minimap_Texel& left, const Minimap_Texel& right) {
+    if (left.y != right.y)
+        return (left.y < right.y ? -1 : 1);
+    if (left.x != right.x)
+        return (left.x < right.x ? -1 : 1);
+    return 0;
+}
+
+static Minimap_Texel* get_texel(cz::Vector<Minimap_Texel>* level, int64_t x, int64_t y) {
+    Minimap_Texel texel = {};
+    texel.x = x;
+    texel.y = y;
+
+    size_t index;
+    if (!cz::binary_search(level->as_slice(), texel, &index, compare_texels)) {
+        level->reserve(cz::heap_allocator(), 1);
+        level->insert(index, texel);
+    }
+    return &(*level)[index];
+}
+
+/// Copy the tile's summary into the bottom level and add the difference to every level above.
+static void update_tile(Minimap* minimap, const Tile* tile, bool* changed) {
+    Minimap_Texel* bottom = get_texel(&minimap->levels[0], tile->x, tile->y);
+
+    const Tile_Summary& summary = tile->summary;
+    uint64_t delta_fg[3], delta_bg[3];
+    for (int i = 0; i < 3; ++i) {
+        delta_fg[i] = summary.fg_sums[i] - bottom->fg_sums[i];
+        delta_bg[i] = summary.bg_sums[i] - bottom->bg_sums[i];
+    }
+    uint64_t delta_count = summary.count - bottom->count;
+    uint64_t delta_ink = summary.ink - bottom->ink;
+
+    bool same = delta_count == 0 && delta_ink == 0;
+    for (int i = 0; i < 3; ++i) {
+        same = same && delta_fg[i] == 0 && delta_bg[i] == 0;
+    }
+    if (same)
+        return;
+
+    *changed = true;
+    extend_bounds(&minimap->tile_bounds, {tile->x, tile->y, tile->x, tile->y});
+
+    // Unsigned wraparound makes adding the difference the same as subtracting.
+    for (int level = 0; level < minimap_levels; ++level) {
+        Minimap_Texel* texel = get_texel(&minimap->levels[level], tile->x >> level,
+                                         tile->y >> level);
+        for (int i = 0; i < 3; ++i) {
+            texel->fg_sums[i] += delta_fg[i];
+            texel->bg_sums[i] += delta_bg[i];
+        }
+        texel->count += delta_count;
+        texel->ink += delta_ink;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - rendering
+///////////////////////////////////////////////////////////////////////////////
+
+/// Same as `cell_color` but averaged over the texel.  Texels
+/// where only some of the cells were drawn fade to white.
+static SDL_Color texel_color(const Minimap_Texel& texel, uint64_t capacity) {
+    float coverage = cz::max(cz::min((float)texel.count / capacity, 1.0f), min_coverage);
+    float ink = (float)texel.ink / texel.count / 2;
+    float channels[3];
+    for (int i = 0; i < 3; ++i) {
+        float fg = (float)texel.fg_sums[i] / texel.count;
+        float bg = (float)texel.bg_sums[i] / texel.count;
+        float average = bg + (fg - bg) * ink;
+        channels[i] = 0xff + (average - 0xff) * coverage;
+    }
+    return {(uint8_t)(channels[0] + 0.5f), (uint8_t)(channels[1] + 0.5f),
+            (uint8_t)(channels[2] + 0.5f), 0xff};
+}
+
+static void draw_outline(SDL_Surface* surface, SDL_Rect rect, uint32_t color) {
+    SDL_Rect top = {rect.x, rect.y, rect.w, 1};
+    SDL_Rect bottom = {rect.x, rect.y + rect.h - 1, rect.w, 1};
+    SDL_Rect left = {rect.x, rect.y, 1, rect.h};
+    SDL_Rect right = {rect.x + rect.w - 1, rect.y, 1, rect.h};
+    SDL_FillRect(surface, &top, color);
+    SDL_FillRect(surface, &bottom, color);
+    SDL_FillRect(surface, &left, color);
+    SDL_FillRect(surface, &right, color);
+}
+
+void render_minimap(SDL_Surface* surface,
+                    const Minimap* minimap,
+                    const SDL_Rect& plane,
+                    float dpi_scale,
+                    const Bounds& visible,
+                    double cell_width,
+                    double cell_height,
+                    Minimap_Layout* layout) {
+    ZoneScoped;
+
+    *layout = {};
+    if (!minimap || minimap->tile_bounds.min_x > minimap->tile_bounds.max_x)
+        return;
+
+    // Don't cover most of a small window.
+    int size = (int)(minimap_size * dpi_scale);
+    int margin = (int)(minimap_margin * dpi_scale);
+    if (plane.w < size * 2 || plane.h < size * 2)
+        return;
+    SDL_Rect area = {plane.x + plane.w - size - margin, plane.y + plane.h - size - margin, size,
+                     size};
+
+    // Show the visible area too so you can see where you are relative to the run.
+    Bounds content = {minimap->tile_bounds.min_x * tile_size,
+                      minimap->tile_bounds.min_y * tile_size,
+                      (minimap->tile_bounds.max_x + 1) * tile_size - 1,
+                      (minimap->tile_bounds.max_y + 1) * tile_size - 1};
+    extend_bounds(&content, visible);
+
+    // Keep the aspect ratio of the plane.
+    double content_width = (content.max_x - content.min_x + 1) * cell_width;
+    double content_height = (content.max_y - content.min_y + 1) * cell_height;
+    double scale = cz::min(area.w / content_width, area.h / content_height);
+    layout->scale_x = cell_width * scale;
+    layout->scale_y = cell_height * scale;
+
+    int width = cz::max((int)ceil(content_width * scale), 1);
+    int height = cz::max((int)ceil(content_height * scale), 1);
+    layout->rect = {area.x + area.w - width, area.y + area.h - height, width, height};
+    layout->plane = plane;
+    layout->cell_width = cell_width;
+    layout->cell_height = cell_height;
+    layout->min_x = content.min_x;
+    layout->min_y = content.min_y;
+
+    SDL_Rect rect = layout->rect;
+    SDL_FillRect(surface, &rect, SDL_MapRGB(surface->format, 0xff, 0xff, 0xff));
+
+    // Use the finest level where texels are still a few pixels.
+    int level = 0;
+    while (level + 1 < minimap_levels &&
+           ((tile_size << level) * layout->scale_x < min_texel_pixels ||
+            (tile_size << level) * layout->scale_y < min_texel_pixels)) {
+        ++level;
+    }
+
+    int64_t texel_cells = tile_size << level;
+    uint64_t capacity = (uint64_t)(texel_cells * texel_cells);
+    const cz::Vector<Minimap_Texel>& texels = minimap->levels[level];
+    for (size_t i = 0; i < texels.len; ++i) {
+        const Minimap_Texel& texel = texels[i];
+        if (texel.count == 0)
+            continue;
+
+        int64_t cell_x = texel.x * texel_cells - content.min_x;
+        int64_t cell_y = texel.y * texel_cells - content.min_y;
+        int x0 = rect.x + (int)floor(cell_x * layout->scale_x);
+        int y0 = rect.y + (int)floor(cell_y * layout->scale_y);
+        int x1 = rect.x + (int)floor((cell_x + texel_cells) * layout->scale_x);
+        int y1 = rect.y + (int)floor((cell_y + texel_cells) * layout->scale_y);
+        SDL_Rect texel_rect = {x0, y0, cz::max(x1 - x0, 1), cz::max(y1 - y0, 1)};
+
+        SDL_Color color = texel_color(texel, capacity);
+        SDL_FillRect(surface, &texel_rect, SDL_MapRGB(surface->format, color.r, color.g, color.b));
+    }
+
+    // Outline the visible area.
+    SDL_Rect view = {
+        rect.x + (int)floor((visible.min_x - content.min_x) * layout->scale_x),
+        rect.y + (int)floor((visible.min_y - content.min_y) * layout->scale_y),
+        0,
+        0,
+    };
+    view.w = cz::max((int)ceil((visible.max_x - visible.min_x + 1) * layout->scale_x), 1);
+    view.h = cz::max((int)ceil((visible.max_y - visible.min_y + 1) * layout->scale_y), 1);
+    draw_outline(surface, view, SDL_MapRGB(surface->format, 0x00, 0x00, 0xd7));
+
+    SDL_Rect border = {rect.x - 1, rect.y - 1, rect.w + 2, rect.h + 2};
+    draw_outline(surface, border, SDL_MapRGB(surface->format, 0x00, 0x00, 0x00));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - navigation
+///////////////////////////////////////////////////////////////////////////////
+
+bool minimap_jump(const Minimap_Layout& layout, SDL_Point point, int64_t* off_x, int64_t* off_y) {
+    const SDL_Rect& rect = layout.rect;
+    if (rect.w == 0 || point.x < rect.x || point.x >= rect.x + rect.w || point.y < rect.y ||
+        point.y >= rect.y + rect.h) {
+        return false;
+    }
+
+    double cell_x = layout.min_x + (point.x - rect.x) / layout.scale_x;
+    double cell_y = layout.min_y + (point.y - rect.y) / layout.scale_y;
+    *off_x = (int64_t)(layout.plane.w / 2 - cell_x * layout.cell_width);
+    *off_y = (int64_t)(layout.plane.h / 2 - cell_y * layout.cell_height);
+    return true;
+}
+
+}
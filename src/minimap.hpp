@@ -0,0 +1,87 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdint.h>
+#include <cz/vector.hpp>
+
+#include "event.hpp"
+#include "grid.hpp"
+
+namespace gridviz {
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/// Level `i` of the pyramid has one texel per `2^i` by `2^i` tiles.
+const int minimap_levels = 16;
+
+/// Sums of the cells in a square of tiles.
+struct Minimap_Texel {
+    /// Position in texels of its level.
+    int64_t x, y;
+
+    uint64_t fg_sums[3];
+    uint64_t bg_sums[3];
+    uint64_t count;
+    uint64_t ink;
+};
+
+/// An overview of the latest state of a run.  Updated incrementally as strokes come in.
+struct Minimap {
+    /// The grid after every stroke.  Forked from the newest keyframe
+    /// so only the tiles touched since then are owned by it.
+    Grid grid;
+    bool valid;
+    size_t keyframe_stroke;
+
+    /// The first `stroke` strokes have been applied.  Only the first
+    /// `segment` segments of the last of them have been applied.
+    size_t stroke;
+    size_t segment;
+
+    /// Each level is sorted by `(y, x)`.
+    cz::Vector<Minimap_Texel> levels[minimap_levels];
+    /// Bounds of the tiles with cells.
+    Bounds tile_bounds;
+
+    /// Cells that were drawn since the pyramid was last updated.
+    cz::Vector<Bounds> dirty;
+};
+
+/// Where the minimap was drawn.  Used to jump to the clicked position.
+struct Minimap_Layout {
+    SDL_Rect rect;
+    SDL_Rect plane;
+    double cell_width, cell_height;
+
+    /// The cell at the top left of `rect` and the number of pixels per cell.
+    int64_t min_x, min_y;
+    double scale_x, scale_y;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Function Declarations
+///////////////////////////////////////////////////////////////////////////////
+
+/// Apply the strokes the run's minimap hasn't seen yet and update the tiles they
+/// touched in the pyramid.  Returns `true` if the pyramid changed.
+bool update_minimap(Run_Info* run);
+
+/// Draw the minimap in the bottom right of the plane with an outline around
+/// `visible`.  Cells are `cell_width` by `cell_height` pixels in the plane.
+void render_minimap(SDL_Surface* surface,
+                    const Minimap* minimap,
+                    const SDL_Rect& plane,
+                    float dpi_scale,
+                    const Bounds& visible,
+                    double cell_width,
+                    double cell_height,
+                    Minimap_Layout* layout);
+
+/// If `point` is on the minimap then get the offsets that center the plane on it.
+bool minimap_jump(const Minimap_Layout& layout, SDL_Point point, int64_t* off_x, int64_t* off_y);
+
+void drop_minimap(Minimap* minimap);
+
+}
@@ -0,0 +1,141 @@
+#include "protocol.hpp"
+
+#include <string.h>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+
+#define NETGRIDVIZ_DEFINE_PROTOCOL
+#include "../netgridviz.h"
+
+namespace gridviz {
+
+Varint_Result read_varint(cz::Str buffer, size_t* index, uint64_t* value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*index >= buffer.len)
+            return VARINT_INCOMPLETE;
+
+        uint8_t byte = buffer[(*index)++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return VARINT_OK;
+        }
+    }
+    return VARINT_INVALID;
+}
+
+int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)((value >> 1) ^ (0 - (value & 1)));
+}
+
+size_t get_event_length(uint8_t type, cz::Str buffer) {
+    if (type & GRIDVIZ_COMPACT_CHAR) {
+        // If a varint is incomplete then we need at least one more byte.
+        int count = 0;
+        if (!(type & GRIDVIZ_COMPACT_SAME_CONTEXT))
+            count += 1;
+        if (!(type & GRIDVIZ_COMPACT_NEXT_CELL))
+            count += 2;
+
+        size_t index = 1;
+        for (int i = 0; i < count; ++i) {
+            uint64_t ignored;
+            Varint_Result result = read_varint(buffer, &index, &ignored);
+            if (result == VARINT_INCOMPLETE)
+                return buffer.len + 1;
+            if (result == VARINT_INVALID)
+                return invalid_event_length;
+        }
+        return index + 1;
+    }
+
+    switch (type) {
+    case GRIDVIZ_SET_FG:
+    case GRIDVIZ_SET_BG:
+        return 6;
+    case GRIDVIZ_START_STROKE: {
+        if (buffer.len < 5)
+            return 5;
+        uint32_t title_len;
+        memcpy(&title_len, buffer.buffer + 1, sizeof(title_len));
+        if (title_len > max_message_payload)
+            return invalid_event_length;
+        return 5 + (size_t)title_len;
+    }
+    case GRIDVIZ_SEND_CHAR:
+        return 20;
+    case GRIDVIZ_SEND_STRING: {
+        if (buffer.len < 23)
+            return 23;
+        uint32_t string_len;
+        memcpy(&string_len, buffer.buffer + 19, sizeof(string_len));
+        if (string_len > max_message_payload)
+            return invalid_event_length;
+        return 23 + (size_t)string_len;
+    }
+    case GRIDVIZ_SEND_GRID: {
+        if (buffer.len < 28)
+            return 28;
+        uint32_t width, height;
+        uint8_t flags;
+        memcpy(&width, buffer.buffer + 19, sizeof(width));
+        memcpy(&height, buffer.buffer + 23, sizeof(height));
+        memcpy(&flags, buffer.buffer + 27, sizeof(flags));
+        uint64_t cell_size = 1;
+        if (flags & GRIDVIZ_GRID_HAS_FG)
+            cell_size += 3;
+        if (flags & GRIDVIZ_GRID_HAS_BG)
+            cell_size += 3;
+        // The product of two 32 bit numbers fits in 64 bits so check it before scaling.
+        uint64_t cells = (uint64_t)width * (uint64_t)height;
+        if (cells > max_message_payload / cell_size)
+            return invalid_event_length;
+        return 28 + (size_t)(cells * cell_size);
+    }
+    case GRIDVIZ_HELLO:
+        return 5;
+    default:
+        return invalid_event_length;
+    }
+}
+
+#ifdef __linux__
+bool open_ring_reader(Ring_Reader* reader, void* memory, size_t size) {
+    if (size < sizeof(gridviz_ring_header))
+        return false;
+
+    gridviz_ring_header* header = (gridviz_ring_header*)memory;
+    uint64_t capacity = __atomic_load_n(&header->capacity, __ATOMIC_RELAXED);
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        capacity > size - sizeof(gridviz_ring_header)) {
+        return false;
+    }
+
+    reader->header = header;
+    reader->data = (const char*)(header + 1);
+    reader->capacity = capacity;
+    reader->head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool ring_available(const Ring_Reader* reader, uint64_t* available) {
+    uint64_t tail = __atomic_load_n(&reader->header->tail, __ATOMIC_ACQUIRE);
+    *available = tail - reader->head;
+    return *available <= reader->capacity;
+}
+
+void read_ring(Ring_Reader* reader, cz::String* buffer, size_t count) {
+    size_t offset = (size_t)(reader->head & (reader->capacity - 1));
+    size_t first = cz::min(count, (size_t)(reader->capacity - offset));
+
+    buffer->reserve(cz::heap_allocator(), count);
+    buffer->append({reader->data + offset, first});
+    buffer->append({reader->data, count - first});
+
+    reader->head += count;
+    __atomic_store_n(&reader->header->head, reader->head, __ATOMIC_RELEASE);
+}
+#endif
+
+}
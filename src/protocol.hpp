@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/str.hpp>
+#include <cz/string.hpp>
+
+struct gridviz_ring_header;
+
+namespace gridviz {
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/// Messages are buffered whole so reject clients that send titles,
+/// strings or grids with more data than this.
+const uint64_t max_message_payload = (uint64_t)1 << 30;
+/// Returned by `get_event_length` if the message is malformed.  The client is disconnected.
+const size_t invalid_event_length = SIZE_MAX;
+
+enum Varint_Result {
+    VARINT_OK,
+    /// The buffer ends before the varint does.
+    VARINT_INCOMPLETE,
+    /// The varint is longer than 10 bytes.
+    VARINT_INVALID,
+};
+
+#ifdef __linux__
+/// The server's side of a shared memory ring.  The client can write to the header at any
+/// time so the capacity and head are read once when the ring is opened and only `tail` is
+/// read afterwards.  `head` is written back so the client knows how much space is free.
+struct Ring_Reader {
+    gridviz_ring_header* header;
+    const char* data;
+    uint64_t capacity;
+    uint64_t head;
+};
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Function Declarations
+///////////////////////////////////////////////////////////////////////////////
+
+/// Read a varint starting at `*index`.  `*index` is advanced past the bytes read.
+Varint_Result read_varint(cz::Str buffer, size_t* index, uint64_t* value);
+
+int64_t zigzag_decode(uint64_t value);
+
+/// Get the length of the message of type `type` at the start of `buffer`.  If `buffer`
+/// is too short to tell then the result is longer than `buffer` so the caller waits for
+/// more data.  Returns `invalid_event_length` if the message can never be parsed.
+size_t get_event_length(uint8_t type, cz::Str buffer);
+
+#ifdef __linux__
+/// Check the header of the `size` byte ring at `memory`.  Returns `false` if it is invalid.
+bool open_ring_reader(Ring_Reader* reader, void* memory, size_t size);
+
+/// Get the number of bytes the client has written that haven't been read.
+/// Returns `false` if the client moved the tail to somewhere impossible.
+bool ring_available(const Ring_Reader* reader, uint64_t* available);
+
+/// Append `count` bytes from the ring to `buffer` and tell the client they were read.
+/// `count` must be at most what `ring_available` returned.
+void read_ring(Ring_Reader* reader, cz::String* buffer, size_t count);
+#endif
+
+}
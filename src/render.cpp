@@ -1,11 +1,16 @@
 #include "render.hpp"
 
 #include <SDL_image.h>
+#include <stdio.h>
+#include <string.h>
 #include <Tracy.hpp>
 #include <cz/binary_search.hpp>
 #include <cz/format.hpp>
+#include <cz/heap.hpp>
 #include <cz/string.hpp>
+#include <cz/util.hpp>
 
+#include "composite.hpp"
 #include "global.hpp"
 #include "unicode.hpp"
 
@@ -52,10 +57,43 @@ void set_icon(SDL_Window* sdl_window) {
 // Font manipulation
 ///////////////////////////////////////////////////////////////////////////////
 
+/// Zooming steps through sizes 25% apart so rasterizing every size it
+/// lands on would fill the cache with sizes that are barely different.
+static const int rasterized_font_sizes[] = {
+    4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 16,  18,  20,  22,  24,  28,
+    32, 36, 40, 44, 48, 56, 64, 72, 80, 96, 112, 128, 160, 192, 224, 256,
+};
+
+/// Estimate of the memory used by FreeType for each open font.
+static const size_t font_overhead = 256 << 10;
+
+/// Each size's atlas may use this fraction of the memory budget before replacing glyphs.
+static const size_t atlas_budget_divisor = 8;
+static const uint32_t min_atlas_slots = 128;
+
+int quantize_font_size(int font_size) {
+    const size_t count = sizeof(rasterized_font_sizes) / sizeof(rasterized_font_sizes[0]);
+    if (font_size <= rasterized_font_sizes[0])
+        return rasterized_font_sizes[0];
+
+    for (size_t i = 1; i < count; ++i) {
+        int low = rasterized_font_sizes[i - 1];
+        int high = rasterized_font_sizes[i];
+        if (font_size <= high)
+            return (font_size - low < high - font_size ? low : high);
+    }
+    return rasterized_font_sizes[count - 1];
+}
+
 Size_Cache* open_font(Font_State* rend, const char* path, int font_size) {
+    font_size = quantize_font_size(font_size);
+
     size_t index;
-    if (cz::binary_search(rend->font_sizes.as_slice(), font_size, &index))
-        return &rend->by_size[index];
+    if (cz::binary_search(rend->font_sizes.as_slice(), font_size, &index)) {
+        Size_Cache* size_cache = &rend->by_size[index];
+        size_cache->last_used = rend->frame;
+        return size_cache;
+    }
 
     ZoneScoped;
 
@@ -68,6 +106,12 @@ Size_Cache* open_font(Font_State* rend, const char* path, int font_size) {
     size_cache.font_width = 10;
     TTF_GlyphMetrics(size_cache.font, ' ', nullptr, nullptr, nullptr, nullptr,
                      &size_cache.font_width);
+    size_cache.last_used = rend->frame;
+
+    size_t glyph_bytes = cz::max((size_t)size_cache.font_width * size_cache.font_height, (size_t)1);
+    size_t budget = (rend->memory_budget ? rend->memory_budget : default_font_memory_budget);
+    size_cache.atlas.max_slots =
+        (uint32_t)cz::max(budget / atlas_budget_divisor / glyph_bytes, (size_t)min_atlas_slots);
 
     rend->font_sizes.reserve(cz::heap_allocator(), 1);
     rend->font_sizes.insert(index, font_size);
@@ -76,50 +120,233 @@ Size_Cache* open_font(Font_State* rend, const char* path, int font_size) {
     return &rend->by_size[index];
 }
 
+static size_t size_cache_memory(const Size_Cache* size_cache) {
+    const Glyph_Atlas& atlas = size_cache->atlas;
+    return font_overhead + sizeof(Size_Cache) + atlas.coverage.cap +
+           (atlas.code_points.cap + atlas.slots.cap) * sizeof(uint32_t) +
+           atlas.slot_last_used.cap * sizeof(uint64_t) +
+           (size_cache->scratch ? (size_t)size_cache->scratch->pitch * size_cache->scratch->h : 0);
+}
+
+size_t font_cache_memory(const Font_State* rend) {
+    size_t total = rend->font_sizes.cap * sizeof(int);
+    for (size_t i = 0; i < rend->by_size.len; ++i) {
+        total += size_cache_memory(&rend->by_size[i]);
+    }
+    return total;
+}
+
+static void close_size_cache(Size_Cache* size_cache) {
+    TTF_CloseFont(size_cache->font);
+    if (size_cache->scratch)
+        SDL_FreeSurface(size_cache->scratch);
+    size_cache->atlas.code_points.drop(cz::heap_allocator());
+    size_cache->atlas.slots.drop(cz::heap_allocator());
+    size_cache->atlas.coverage.drop(cz::heap_allocator());
+    size_cache->atlas.slot_last_used.drop(cz::heap_allocator());
+}
+
+void trim_fonts(Font_State* rend) {
+    ZoneScoped;
+
+    size_t budget = (rend->memory_budget ? rend->memory_budget : default_font_memory_budget);
+    size_t memory = font_cache_memory(rend);
+    while (memory > budget) {
+        // Find the least recently used size.  Sizes used this frame are kept.
+        size_t victim = rend->by_size.len;
+        for (size_t i = 0; i < rend->by_size.len; ++i) {
+            const Size_Cache* size_cache = &rend->by_size[i];
+            if (size_cache->last_used == rend->frame)
+                continue;
+            if (victim == rend->by_size.len ||
+                size_cache->last_used < rend->by_size[victim].last_used) {
+                victim = i;
+            }
+        }
+        if (victim == rend->by_size.len)
+            break;
+
+        memory -= size_cache_memory(&rend->by_size[victim]);
+        close_size_cache(&rend->by_size[victim]);
+        rend->font_sizes.remove(victim);
+        rend->by_size.remove(victim);
+    }
+
+    TracyPlot("Font cache bytes", (int64_t)memory);
+    ++rend->frame;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Module Code - text cache manipulation
 ///////////////////////////////////////////////////////////////////////////////
 
-static SDL_Surface* rasterize_code_point(const char* text,
-                                         TTF_Font* font,
-                                         int style,
-                                         SDL_Color fgc) {
+static SDL_Surface* rasterize_code_point(const char* text, TTF_Font* font, int style) {
     ZoneScoped;
     TTF_SetFontStyle(font, style);
-    return TTF_RenderUTF8_Blended(font, text, fgc);
+    // Rasterize in white so the alpha channel is the coverage.
+    SDL_Color white = {0xff, 0xff, 0xff, 0xff};
+    return TTF_RenderUTF8_Blended(font, text, white);
 }
 
-static SDL_Surface* rasterize_code_point_cached(Size_Cache* rend,
-                                                const char seq[5],
-                                                SDL_Color color) {
+/// Copy the alpha channel of a 32 bit surface into a `width` by `height` glyph.
+static void copy_coverage(uint8_t* glyph, int width, int height, SDL_Surface* surface) {
+    CZ_ASSERT(surface->format->BytesPerPixel == 4);
+
+    if (SDL_MUSTLOCK(surface))
+        SDL_LockSurface(surface);
+
+    SDL_PixelFormat* format = surface->format;
+    int rows = cz::min(height, surface->h);
+    int columns = cz::min(width, surface->w);
+    for (int y = 0; y < rows; ++y) {
+        const uint32_t* pixels =
+            (const uint32_t*)((const uint8_t*)surface->pixels + (size_t)y * surface->pitch);
+        for (int x = 0; x < columns; ++x) {
+            glyph[y * width + x] = (uint8_t)((pixels[x] & format->Amask) >> format->Ashift);
+        }
+    }
+
+    if (SDL_MUSTLOCK(surface))
+        SDL_UnlockSurface(surface);
+}
+
+static size_t glyph_size(const Size_Cache* rend) {
+    return (size_t)rend->font_width * rend->font_height;
+}
+
+/// If the atlas is full then remove the least recently used glyph and return its
+/// slot.  Glyphs used this frame are kept since they may be about to be drawn.
+/// Returns `UINT32_MAX` if the atlas should grow instead.
+static uint32_t replace_glyph(Size_Cache* rend) {
+    Glyph_Atlas* atlas = &rend->atlas;
+    if (atlas->slot_last_used.len < atlas->max_slots)
+        return UINT32_MAX;
+
+    uint32_t victim = UINT32_MAX;
+    for (uint32_t slot = 0; slot < atlas->slot_last_used.len; ++slot) {
+        if (atlas->slot_last_used[slot] == rend->last_used)
+            continue;
+        if (victim == UINT32_MAX || atlas->slot_last_used[slot] < atlas->slot_last_used[victim])
+            victim = slot;
+    }
+    if (victim == UINT32_MAX)
+        return UINT32_MAX;
+
+    for (size_t i = 0; i < atlas->slots.len; ++i) {
+        if (atlas->slots[i] == victim) {
+            atlas->code_points.remove(i);
+            atlas->slots.remove(i);
+            break;
+        }
+    }
+    return victim;
+}
+
+/// Get the slot of the code point in the atlas.  Rasterizes it on a cache miss.
+static uint32_t rasterize_code_point_cached(Size_Cache* rend, const char seq[5]) {
     uint32_t code_point = unicode::utf8_code_point((const uint8_t*)seq);
+    Glyph_Atlas* atlas = &rend->atlas;
 
-    // Find the cache for this color.
+    // Check the cache.
     size_t index;
-    uint32_t color32 = ((uint32_t)color.r << 16) | ((uint32_t)color.g << 8) |  //
-                       ((uint32_t)color.b << 0);
-    if (!cz::binary_search(rend->colors.as_slice(), color32, &index)) {
-        rend->colors.reserve(cz::heap_allocator(), 1);
-        rend->colors.insert(index, color32);
-        rend->by_color.reserve(cz::heap_allocator(), 1);
-        rend->by_color.insert(index, {});
+    if (cz::binary_search(atlas->code_points.as_slice(), code_point, &index)) {
+        // Cache hit.
+        uint32_t slot = atlas->slots[index];
+        atlas->slot_last_used[slot] = rend->last_used;
+        return slot;
     }
 
-    // Check the cache.
-    Color_Cache* cache = &rend->by_color[index];
-    if (cz::binary_search(cache->code_points.as_slice(), code_point, &index))
-        return cache->surfaces[index];  // Cache hit.
+    // Cache miss.  Rasterize and add to the atlas.  If rasterization fails then the slot
+    // is left blank so the failure is only reported once.
+    SDL_Surface* surface = rasterize_code_point(seq, rend->font, 0);
+    if (!surface)
+        fprintf(stderr, "Failed to render U+%04X: %s\n", code_point, SDL_GetError());
+
+    uint32_t slot = replace_glyph(rend);
+    if (slot == UINT32_MAX) {
+        slot = (uint32_t)atlas->slot_last_used.len;
+        atlas->coverage.reserve(cz::heap_allocator(), glyph_size(rend));
+        atlas->coverage.len += glyph_size(rend);
+        atlas->slot_last_used.reserve(cz::heap_allocator(), 1);
+        atlas->slot_last_used.push(0);
+    } else {
+        // Removing the old glyph may have moved our position.
+        (void)cz::binary_search(atlas->code_points.as_slice(), code_point, &index);
+    }
+    atlas->slot_last_used[slot] = rend->last_used;
+
+    uint8_t* glyph = atlas->coverage.elems + slot * glyph_size(rend);
+    memset(glyph, 0, glyph_size(rend));
+    if (surface) {
+        copy_coverage(glyph, rend->font_width, rend->font_height, surface);
+        SDL_FreeSurface(surface);
+    }
+
+    atlas->code_points.reserve(cz::heap_allocator(), 1);
+    atlas->code_points.insert(index, code_point);
+    atlas->slots.reserve(cz::heap_allocator(), 1);
+    atlas->slots.insert(index, slot);
+
+    return slot;
+}
+
+static const uint8_t* get_glyph(const Size_Cache* rend, uint32_t slot) {
+    return rend->atlas.coverage.elems + slot * glyph_size(rend);
+}
+
+bool is_direct_format(const SDL_PixelFormat* format) {
+    return format->BytesPerPixel == 4 && format->Rloss == 0 && format->Gloss == 0 &&
+           format->Bloss == 0;
+}
+
+uint32_t pack_color(const SDL_PixelFormat* format, SDL_Color color) {
+    return ((uint32_t)color.r << format->Rshift) | ((uint32_t)color.g << format->Gshift) |
+           ((uint32_t)color.b << format->Bshift) | format->Amask;
+}
 
-    // Cache miss.  Rasterize and add to the cache.
-    SDL_Surface* surface = rasterize_code_point(seq, rend->font, 0, color);
-    CZ_ASSERT(surface);
+/// Slow path for other formats.  Blend the glyph into the 32 bit scratch
+/// surface and let SDL convert it to the window's format in one blit.
+static bool composite_glyph_slow(Size_Cache* rend,
+                                 SDL_Surface* surface,
+                                 SDL_Rect rect,
+                                 const uint8_t* glyph,
+                                 SDL_Color background,
+                                 SDL_Color foreground) {
+    if (!rend->scratch) {
+        rend->scratch = SDL_CreateRGBSurfaceWithFormat(0, rend->font_width, rend->font_height,
+                                                       32, SDL_PIXELFORMAT_RGB888);
+        if (!rend->scratch)
+            return false;
+    }
+
+    SDL_Surface* scratch = rend->scratch;
+    if (SDL_MUSTLOCK(scratch))
+        SDL_LockSurface(scratch);
+    for (int y = 0; y < rect.h; ++y) {
+        const uint8_t* coverage = glyph + (size_t)y * rend->font_width;
+        uint32_t* pixels = (uint32_t*)((uint8_t*)scratch->pixels + (size_t)y * scratch->pitch);
+        for (int x = 0; x < rect.w; ++x) {
+            uint32_t alpha = coverage[x];
+            SDL_Color color;
+            color.r = (uint8_t)((background.r * (255 - alpha) + foreground.r * alpha + 127) / 255);
+            color.g = (uint8_t)((background.g * (255 - alpha) + foreground.g * alpha + 127) / 255);
+            color.b = (uint8_t)((background.b * (255 - alpha) + foreground.b * alpha + 127) / 255);
+            pixels[x] = pack_color(scratch->format, color);
+        }
+    }
+    if (SDL_MUSTLOCK(scratch))
+        SDL_UnlockSurface(scratch);
 
-    cache->code_points.reserve(cz::heap_allocator(), 1);
-    cache->code_points.insert(index, code_point);
-    cache->surfaces.reserve(cz::heap_allocator(), 1);
-    cache->surfaces.insert(index, surface);
+    SDL_Rect source = {0, 0, rect.w, rect.h};
+    return SDL_BlitSurface(scratch, &source, surface, &rect) == 0;
+}
 
-    return surface;
+/// Replace bytes that don't draw correctly.
+static void clean_seq(char seq[5]) {
+    if (cz::is_space(seq[0]))
+        seq[0] = ' ';
+    if (seq[0] == 0)
+        seq[0] = 1;  // 0 would count as empty string which breaks rendering.
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -144,24 +371,164 @@ bool render_code_point(Size_Cache* rend,
         return false;
 
     char seq[5];
-    memcpy(seq, seq_in, sizeof(seq_in));
+    memcpy(seq, seq_in, sizeof(seq));
+    clean_seq(seq);
+
+    if (is_direct_format(window_surface->format)) {
+        Cell cell = {px, background, foreground};
+        memcpy(cell.seq, seq, sizeof(seq));
+        render_cell_row(rend, window_surface, py, {&cell, 1});
+        return true;
+    }
 
-    // Little bit of input cleanup.
-    if (cz::is_space(seq[0]))
-        seq[0] = ' ';
-    if (seq[0] == 0)
-        seq[0] = 1;  // 0 would count as empty string which breaks rendering.
+    const uint8_t* glyph = get_glyph(rend, rasterize_code_point_cached(rend, seq));
+
+    // Clip the cell to the clip rectangle.
+    SDL_Rect cell = {(int)px, (int)py, rend->font_width, rend->font_height};
+    SDL_Rect rect;
+    if (!SDL_IntersectRect(&cell, &window_surface->clip_rect, &rect))
+        return false;
+    glyph += (rect.y - cell.y) * rend->font_width + (rect.x - cell.x);
+
+    // Blitting locks the window surface itself.
+    return composite_glyph_slow(rend, window_surface, rect, glyph, background, foreground);
+}
 
-    SDL_Surface* s = rasterize_code_point_cached(rend, seq, foreground);
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - render cell row
+///////////////////////////////////////////////////////////////////////////////
 
-    SDL_Rect rect = {(int)px, (int)py, rend->font_width, rend->font_height};
-    uint32_t bg32 = SDL_MapRGB(window_surface->format, background.r, background.g, background.b);
-    SDL_FillRect(window_surface, &rect, bg32);
+/// Number of cells prepared before compositing.
+static const size_t cell_batch_size = 64;
+
+/// Draw the rows `[start_row, end_row)` of the cells.  Glyphs are looked up in
+/// `table` if it isn't null and are otherwise rasterized on demand.
+static void composite_cells(Size_Cache* rend,
+                            const Glyph_Table* table,
+                            SDL_Surface* window_surface,
+                            const SDL_Rect& clip,
+                            int64_t py,
+                            int64_t start_row,
+                            int64_t end_row,
+                            cz::Slice<const Cell> cells) {
+    SDL_PixelFormat* format = window_surface->format;
+
+    // Rasterize every glyph first since adding to the atlas moves it.
+    uint32_t slots[cell_batch_size];
+    int64_t first_columns[cell_batch_size];
+    Composite_Cell composite[cell_batch_size];
+    size_t count = 0;
+    for (size_t i = 0; i < cells.len; ++i) {
+        const Cell& cell = cells[i];
+        int64_t start_x = cz::max(cell.px, (int64_t)clip.x);
+        int64_t end_x = cz::min(cell.px + rend->font_width, (int64_t)clip.x + clip.w);
+        if (start_x >= end_x)
+            continue;
+
+        char seq[5];
+        memcpy(seq, cell.seq, sizeof(seq));
+        clean_seq(seq);
+
+        if (table) {
+            slots[count] = table->slots[(uint8_t)seq[0]];
+            if (slots[count] == UINT32_MAX)
+                continue;
+        } else {
+            slots[count] = rasterize_code_point_cached(rend, seq);
+        }
+        first_columns[count] = start_x - cell.px;
+        composite[count].foreground = pack_color(format, cell.foreground);
+        composite[count].background = pack_color(format, cell.background);
+        composite[count].x = (uint32_t)start_x;
+        composite[count].width = (uint32_t)(end_x - start_x);
+        ++count;
+    }
 
-    SDL_Rect clip_character = {0, 0, rend->font_width, rend->font_height};
-    SDL_BlitSurface(s, &clip_character, window_surface, &rect);
+    // Point at the first visible pixel of each glyph.
+    int64_t first_row = (start_row - py) * rend->font_width;
+    for (size_t i = 0; i < count; ++i) {
+        composite[i].coverage = get_glyph(rend, slots[i]) + first_row + first_columns[i];
+    }
 
-    return true;
+    for (int64_t y = start_row; y < end_row; ++y) {
+        uint32_t* pixels = (uint32_t*)((uint8_t*)window_surface->pixels +
+                                       (size_t)y * window_surface->pitch);
+        composite_row(pixels, composite, count, (size_t)(y - start_row) * rend->font_width);
+    }
+}
+
+void render_cell_row(Size_Cache* rend,
+                     SDL_Surface* window_surface,
+                     int64_t py,
+                     cz::Slice<const Cell> cells) {
+    ZoneScoped;
+
+    if (!is_direct_format(window_surface->format)) {
+        for (size_t i = 0; i < cells.len; ++i) {
+            const Cell& cell = cells[i];
+            (void)render_code_point(rend, window_surface, cell.px, py, cell.background,
+                                    cell.foreground, cell.seq);
+        }
+        return;
+    }
+
+    SDL_Rect clip = window_surface->clip_rect;
+    int64_t start_row = cz::max(py, (int64_t)clip.y);
+    int64_t end_row = cz::min(py + rend->font_height, (int64_t)clip.y + clip.h);
+    if (start_row >= end_row)
+        return;
+
+    if (SDL_MUSTLOCK(window_surface))
+        SDL_LockSurface(window_surface);
+
+    for (size_t start = 0; start < cells.len; start += cell_batch_size) {
+        size_t end = cz::min(cells.len, start + cell_batch_size);
+        composite_cells(rend, nullptr, window_surface, clip, py, start_row, end_row,
+                        cells.slice(start, end));
+    }
+
+    if (SDL_MUSTLOCK(window_surface))
+        SDL_UnlockSurface(window_surface);
+}
+
+void prepare_glyph_table(Size_Cache* rend, const bool used[256], Glyph_Table* table) {
+    ZoneScoped;
+
+    (void)get_composite_kernel();
+
+    for (int byte = 0; byte < 256; ++byte) {
+        table->slots[byte] = UINT32_MAX;
+    }
+
+    // Glyphs used this frame are never replaced so earlier slots stay valid.
+    for (int byte = 0; byte < 256; ++byte) {
+        if (!used[byte])
+            continue;
+
+        char seq[5] = {(char)byte};
+        clean_seq(seq);
+        table->slots[(uint8_t)seq[0]] = rasterize_code_point_cached(rend, seq);
+    }
+}
+
+void render_cell_row_shared(const Size_Cache* rend,
+                            const Glyph_Table* table,
+                            SDL_Surface* window_surface,
+                            const SDL_Rect& clip,
+                            int64_t py,
+                            cz::Slice<const Cell> cells) {
+    int64_t start_row = cz::max(py, (int64_t)clip.y);
+    int64_t end_row = cz::min(py + rend->font_height, (int64_t)clip.y + clip.h);
+    if (start_row >= end_row)
+        return;
+
+    // Nothing is rasterized when there is a table so the cache isn't modified.
+    Size_Cache* mutable_rend = const_cast<Size_Cache*>(rend);
+    for (size_t start = 0; start < cells.len; start += cell_batch_size) {
+        size_t end = cz::min(cells.len, start + cell_batch_size);
+        composite_cells(mutable_rend, table, window_surface, clip, py, start_row, end_row,
+                        cells.slice(start, end));
+    }
 }
 
 }
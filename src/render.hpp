@@ -11,32 +11,82 @@ namespace gridviz {
 // Type Definitions
 ///////////////////////////////////////////////////////////////////////////////
 
-struct Color_Cache {
+/// Every code point rasterized at one font size as 8 bit coverage.  Glyphs are
+/// packed one after another, each taking `font_width * font_height` bytes.
+/// Colors are applied when compositing so each glyph is only rasterized once.
+struct Glyph_Atlas {
+    /// Sorted.  The glyph for `code_points[i]` is at index `slots[i]` in `coverage`.
     cz::Vector<uint32_t> code_points;
-    cz::Vector<SDL_Surface*> surfaces;
+    cz::Vector<uint32_t> slots;
+    cz::Vector<uint8_t> coverage;
+
+    /// The frame each slot was last drawn in.
+    cz::Vector<uint64_t> slot_last_used;
+    /// Once there are this many slots the least recently used glyph is replaced.
+    uint32_t max_slots;
 };
 
 struct Size_Cache {
     TTF_Font* font;
     int font_width;
     int font_height;
-    cz::Vector<uint32_t> colors;
-    cz::Vector<Color_Cache> by_color;
+    Glyph_Atlas atlas;
+
+    /// A 32 bit cell sized surface.  Glyphs are blended into it and then blitted
+    /// to windows with other pixel formats.  Created when first needed.
+    SDL_Surface* scratch;
+
+    /// The frame this size was last opened in.
+    uint64_t last_used;
+};
+
+/// The atlas slot of the glyph for every byte.  Looked up ahead of time so
+/// drawing only reads the atlas and can be split across threads.
+struct Glyph_Table {
+    uint32_t slots[256];
+};
+
+/// A cell to be drawn by `render_cell_row`.
+struct Cell {
+    int64_t px;
+    SDL_Color background;
+    SDL_Color foreground;
+    char seq[5];
 };
 
 struct Font_State {
     cz::Vector<int> font_sizes;
     cz::Vector<Size_Cache> by_size;
+
+    /// Incremented by `trim_fonts` at the end of every frame.
+    uint64_t frame;
+
+    /// Sizes that weren't used recently are closed to stay under this many bytes.
+    size_t memory_budget;
 };
 
+const size_t default_font_memory_budget = 64 << 20;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Function Declarations
 ///////////////////////////////////////////////////////////////////////////////
 
 void set_icon(SDL_Window* sdl_window);
 
+/// Open the font at the closest rasterized size to `font_size`.  The
+/// result is valid until the next call to `trim_fonts`.
 Size_Cache* open_font(Font_State* rend, const char* path, int font_size);
 
+/// Round a font size to one of the sizes that are actually rasterized.
+int quantize_font_size(int font_size);
+
+/// Call at the end of each frame.  Evicts the least recently
+/// used sizes until the cache fits in the memory budget.
+void trim_fonts(Font_State* rend);
+
+/// Estimate of the memory held by the cache in bytes.
+size_t font_cache_memory(const Font_State* rend);
+
 bool render_code_point(Size_Cache* rend,
                        SDL_Surface* window_surface,
                        int64_t px,
@@ -45,4 +95,30 @@ bool render_code_point(Size_Cache* rend,
                        SDL_Color foreground,
                        const char seq_in[5]);
 
+/// True if pixels can be written directly as 32 bit integers with 8 bits per channel.
+bool is_direct_format(const SDL_PixelFormat* format);
+/// Convert a color to a pixel of a direct format.
+uint32_t pack_color(const SDL_PixelFormat* format, SDL_Color color);
+
+/// Draw cells whose top edges are all at `py`.  Equivalent to calling `render_code_point`
+/// on each of them but composites directly into the surface one row of pixels at a time.
+void render_cell_row(Size_Cache* rend,
+                     SDL_Surface* window_surface,
+                     int64_t py,
+                     cz::Slice<const Cell> cells);
+
+/// Rasterize the glyph of every byte in `used` and store their slots in the table.
+/// Also picks the compositing kernel so threads drawing with the table don't race to.
+void prepare_glyph_table(Size_Cache* rend, const bool used[256], Glyph_Table* table);
+
+/// Same as `render_cell_row` but clipped to `clip` and drawn with glyphs from the table so
+/// it is safe to call from multiple threads on disjoint clip rectangles.  Each cell must be
+/// a single byte.  The surface must be in a direct format and already locked.
+void render_cell_row_shared(const Size_Cache* rend,
+                            const Glyph_Table* table,
+                            SDL_Surface* window_surface,
+                            const SDL_Rect& clip,
+                            int64_t py,
+                            cz::Slice<const Cell> cells);
+
 }
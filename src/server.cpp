@@ -1,14 +1,22 @@
 #include "server.hpp"
 
+#include <atomic>
 #include <chrono>
+#include <new>
+#include <thread>
+#include <SDL.h>
 #include <cz/binary_search.hpp>
 #include <cz/format.hpp>
 #include <cz/heap.hpp>
+#include <cz/util.hpp>
 
 #define NETGRIDVIZ_DEFINE_PROTOCOL
 #include "../netgridviz.h"
 
 #include "event.hpp"
+#include "grid.hpp"
+#include "protocol.hpp"
+#include "spsc_queue.hpp"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Xplat craziness
@@ -27,11 +35,19 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifdef _WIN32
 #define ssize_t int
 #define socklen_t int
@@ -46,26 +62,147 @@
 
 namespace gridviz {
 
+struct Client;
+
 static int actually_start_server(Network_State* net, int port);
-static void actually_poll_server(Network_State* net, Game_State* game);
+static void start_unix_server(Network_State* net, int port);
+static void network_thread_main(Network_State* net);
+static void accept_clients(Network_State* net);
+static bool receive(Network_State* net, Client* client);
+static bool parse_messages(Client* client);
+static bool publish_batch(Network_State* net, Client* client);
+static void wake_main_thread(Network_State* net);
+static void close_client(Network_State* net, Client* client);
 
 static int winsock_start(void);
 static int winsock_end(void);
 static int make_non_blocking(SOCKET socket);
 
+/// Read from the socket in chunks of at least this size.
+static const size_t receive_chunk_size = 1 << 16;
+/// Maximum number of bytes to read from one client before servicing the other clients.
+static const size_t max_receive_per_poll = 1 << 24;
+
 ///////////////////////////////////////////////////////////////////////////////
 // Type Definitions
 ///////////////////////////////////////////////////////////////////////////////
 
+/// Server side state of a `netgridviz_context`.
+struct Client_Context {
+    uint16_t id;
+    uint8_t fg[3];
+    uint8_t bg[3];
+
+    /// Position of the previous cell drawn via the compact encoding.
+    int64_t x, y;
+};
+
+/// Strokes parsed by the network thread that are waiting to be added to the `Game_State`.
+struct Batch {
+    /// The run the strokes belong to.  Each client gets its own run.
+    uint64_t run_id;
+
+    /// A client connected so the strokes go in a new run.
+    bool new_run;
+    cz::Date start_time;
+
+    /// If `true` then `strokes[0]` is a continuation of the last stroke of the run.
+    bool continue_stroke;
+
+    cz::Vector<Stroke> strokes;
+    /// The titles of the strokes packed together.  `title_starts[i]` is where the title of
+    /// `strokes[i]` starts.  The titles are copied into the run's arena all at once.
+    cz::String titles;
+    cz::Vector<size_t> title_starts;
+
+    /// Colors to append to `Run_Info::palette`.
+    cz::Vector<Color_Pair> new_colors;
+};
+
+/// Maps a color to its index in the palette.
+struct Palette_Entry {
+    Color_Pair colors;
+    Palette_Index index;
+};
+
+/// A connected client.  Owned by the network thread.
+struct Client {
+    SOCKET socket;
+    uint64_t run_id;
+
+    /// Connected via the Unix domain socket.
+    bool is_unix;
+
+#ifdef __linux__
+    /// The shared memory ring sent by the client.  `ring.header`
+    /// is null if the client doesn't use one.
+    Ring_Reader ring;
+    size_t ring_size;
+    int ring_eventfd;
+#endif
+
+    /// Bytes received but not yet parsed.
+    cz::String buffer;
+
+    cz::Vector<Client_Context> contexts;
+
+    /// The context used by the previous compact message.
+    uint16_t last_context_id;
+
+    /// Every color in the run's palette.  Sorted by `colors`.
+    cz::Vector<Palette_Entry> palette;
+    /// The color of the previous cell.  Consecutive cells usually have the same color.
+    Palette_Entry last_color;
+    bool has_last_color;
+
+    /// The batch currently being filled.  Null if nothing has been parsed since it was published.
+    Batch* batch;
+    /// Number of strokes in the run, including ones that have already been published.
+    size_t num_strokes;
+};
+
+/// Maps the run ids used by the network thread to indices in `Game_State::runs`.
+struct Run_Mapping {
+    uint64_t run_id;
+    size_t index;
+};
+
 struct Network_State {
     bool running;
-    cz::String buffer;
 
-    cz::Vector<netgridviz_context> contexts;
-    bool reuse_first_stroke;
+    /// Set by the main thread to tell the network thread to exit.
+    std::atomic<bool> stop;
+    std::thread thread;
+
+    /// Batches published by the network thread.
+    Spsc_Queue<Batch*, 256> queue;
+
+    /// SDL event type pushed to wake the main thread when batches are published.
+    uint32_t wakeup_event;
+    /// Set when a wakeup event is in flight so we don't flood the event queue.
+    std::atomic<bool> wakeup_pending;
+
+    /// Owned by the main thread.  Sorted by `run_id`.
+    cz::Vector<Run_Mapping> runs;
+
+    ///////////////////////////////////////////////
+    // Everything below is owned by the network thread.
+    ///////////////////////////////////////////////
+
+    cz::Vector<Client*> clients;
+    uint64_t next_run_id;
+
+    /// Batches of disconnected clients that didn't fit in the queue.
+    cz::Vector<Batch*> orphans;
 
     SOCKET socket_server = INVALID_SOCKET;
-    SOCKET socket_client = INVALID_SOCKET;
+    SOCKET socket_unix = INVALID_SOCKET;
+#ifndef _WIN32
+    struct sockaddr_un address_unix;
+#endif
+#ifdef __linux__
+    int epoll = -1;
+#endif
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -74,12 +211,14 @@ struct Network_State {
 
 Network_State* start_networking(int port) {
     Network_State* net = cz::heap_allocator().alloc<Network_State>();
-    *net = {};
+    new (net) Network_State();
+    net->wakeup_event = SDL_RegisterEvents(1);
 
     int result = actually_start_server(net, port);
     // TODO report result < 0 somehow???
 
-    net->buffer.reserve(cz::heap_allocator(), 4096);
+    if (net->running)
+        net->thread = std::thread(network_thread_main, net);
     return net;
 }
 
@@ -131,7 +270,32 @@ static int actually_start_server(Network_State* net, int port) {
         goto error;
     }
 
+#ifdef __linux__
+    net->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (net->epoll < 0) {
+        closesocket(net->socket_server);
+        goto error;
+    }
+
+    {
+        // The server sockets are identified by a null pointer.
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        result = epoll_ctl(net->epoll, EPOLL_CTL_ADD, net->socket_server, &event);
+        if (result < 0) {
+            close(net->epoll);
+            net->epoll = -1;
+            closesocket(net->socket_server);
+            goto error;
+        }
+    }
+#endif
+
     net->running = true;
+
+    // Local clients can skip the TCP stack by using the Unix domain socket.
+    start_unix_server(net, port);
     return 1;
 
 error:
@@ -139,192 +303,1049 @@ error:
     return -1;
 }
 
+/// Listen on the Unix domain socket.  Failure is ignored since clients can still use TCP.
+static void start_unix_server(Network_State* net, int port) {
+#ifndef _WIN32
+    SOCKET socket_unix = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_unix == INVALID_SOCKET)
+        return;
+
+    struct sockaddr_un* address = &net->address_unix;
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    snprintf(address->sun_path, sizeof(address->sun_path), GRIDVIZ_UNIX_SOCKET_FORMAT, port);
+
+    // Remove the socket file left over from a previous run.
+    unlink(address->sun_path);
+
+    int result = bind(socket_unix, (sockaddr*)address, sizeof(*address));
+    if (result == SOCKET_ERROR)
+        goto error;
+
+    result = make_non_blocking(socket_unix);
+    if (result == SOCKET_ERROR)
+        goto error;
+
+    result = listen(socket_unix, SOMAXCONN);
+    if (result == SOCKET_ERROR)
+        goto error;
+
+#ifdef __linux__
+    {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        result = epoll_ctl(net->epoll, EPOLL_CTL_ADD, socket_unix, &event);
+        if (result < 0)
+            goto error;
+    }
+#endif
+
+    net->socket_unix = socket_unix;
+    return;
+
+error:
+    closesocket(socket_unix);
+    address->sun_path[0] = '\0';
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Module Code - cleanup
 ///////////////////////////////////////////////////////////////////////////////
 
-void stop_networking(Network_State* net) {
+static void drop_batch(Batch* batch);
+static void drop_client(Client* client);
+static void add_batch(Network_State* net, Game_State* game, Batch* batch);
+
+void stop_networking(Network_State* net, Game_State* game) {
+    if (net->thread.joinable()) {
+        net->stop = true;
+        net->thread.join();
+    }
+
+    // Add everything that was received so it isn't lost.  Batches that were
+    // published come first since they were parsed before the others.
+    Batch* batch;
+    while (net->queue.pop(&batch)) {
+        add_batch(net, game, batch);
+    }
+    for (size_t i = 0; i < net->orphans.len; ++i) {
+        add_batch(net, game, net->orphans[i]);
+    }
+    net->orphans.len = 0;
+    for (size_t i = 0; i < net->clients.len; ++i) {
+        if (net->clients[i]->batch) {
+            add_batch(net, game, net->clients[i]->batch);
+            net->clients[i]->batch = nullptr;
+        }
+    }
+
+    for (size_t i = 0; i < net->clients.len; ++i) {
+        drop_client(net->clients[i]);
+    }
+    net->clients.drop(cz::heap_allocator());
+
+#ifdef __linux__
+    if (net->epoll >= 0)
+        close(net->epoll);
+#endif
+    if (net->socket_server != INVALID_SOCKET)
+        closesocket(net->socket_server);
+#ifndef _WIN32
+    if (net->socket_unix != INVALID_SOCKET) {
+        closesocket(net->socket_unix);
+        unlink(net->address_unix.sun_path);
+    }
+#endif
     winsock_end();
-    net->buffer.drop(cz::heap_allocator());
+
+    net->orphans.drop(cz::heap_allocator());
+
+    net->runs.drop(cz::heap_allocator());
+    net->~Network_State();
     cz::heap_allocator().dealloc(net);
 }
 
+static void drop_client(Client* client) {
+    if (client->socket != INVALID_SOCKET)
+        closesocket(client->socket);
+#ifdef __linux__
+    if (client->ring.header)
+        munmap(client->ring.header, client->ring_size);
+    if (client->ring_eventfd != -1)
+        close(client->ring_eventfd);
+#endif
+    if (client->batch)
+        drop_batch(client->batch);
+    client->buffer.drop(cz::heap_allocator());
+    client->contexts.drop(cz::heap_allocator());
+    client->palette.drop(cz::heap_allocator());
+    cz::heap_allocator().dealloc(client);
+}
+
+static void drop_batch(Batch* batch) {
+    for (size_t i = 0; i < batch->strokes.len; ++i) {
+        drop_stroke(&batch->strokes[i]);
+    }
+    batch->strokes.drop(cz::heap_allocator());
+    batch->titles.drop(cz::heap_allocator());
+    batch->title_starts.drop(cz::heap_allocator());
+    batch->new_colors.drop(cz::heap_allocator());
+    cz::heap_allocator().dealloc(batch);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
-// Module Code - cleanup
+// Module Code - main thread
+///////////////////////////////////////////////////////////////////////////////
+
+static void append_stroke(Stroke* stroke, Stroke* continuation);
+static Run_Info* lookup_run(Network_State* net, Game_State* game, uint64_t run_id);
+
+bool poll_network(Network_State* net, Game_State* game) {
+    // Clear before popping so batches published after this point send another wakeup.
+    net->wakeup_pending = false;
+
+    bool changed = false;
+    Batch* batch;
+    while (net->queue.pop(&batch)) {
+        changed = true;
+        add_batch(net, game, batch);
+    }
+    return changed;
+}
+
+/// Add the strokes and colors in the batch to its run.  Takes ownership of the batch.
+static void add_batch(Network_State* net, Game_State* game, Batch* batch) {
+    if (batch->new_run) {
+        // Create a new run and select it.
+        Run_Info the_run = {};
+        // TODO pull out graphical stuff
+        the_run.selected_stroke = 0;
+        the_run.font_size = 14;
+        the_run.off_x = 10;
+        the_run.off_y = 10;
+        the_run.start_time = batch->start_time;
+        game->runs.reserve(cz::heap_allocator(), 1);
+        game->runs.push(the_run);
+        game->selected_run = game->runs.len - 1;
+
+        // Run ids are allocated in increasing order so this keeps `net->runs` sorted.
+        Run_Mapping mapping = {batch->run_id, game->runs.len - 1};
+        net->runs.reserve(cz::heap_allocator(), 1);
+        net->runs.push(mapping);
+    }
+
+    Run_Info* the_run = lookup_run(net, game, batch->run_id);
+
+    // Add colors first since the strokes reference them.
+    the_run->palette.reserve(cz::heap_allocator(), batch->new_colors.len);
+    the_run->palette.append(batch->new_colors.as_slice());
+
+    // Point the titles into the run's arena.  The title of a continued stroke is empty.
+    char* titles = nullptr;
+    if (batch->titles.len > 0) {
+        titles = run_allocator(the_run).alloc<char>(batch->titles.len);
+        memcpy(titles, batch->titles.buffer, batch->titles.len);
+    }
+    for (size_t i = 0; i < batch->strokes.len; ++i) {
+        batch->strokes[i].title.buffer = titles + batch->title_starts[i];
+    }
+
+    size_t start = 0;
+    if (batch->continue_stroke) {
+        append_stroke(&the_run->strokes.last(), &batch->strokes[0]);
+        start = 1;
+    }
+
+    for (size_t i = start; i < batch->strokes.len; ++i) {
+        the_run->strokes.reserve(cz::heap_allocator(), 1);
+        the_run->strokes.push(batch->strokes[i]);
+
+        // TODO pull out graphical stuff
+        if (the_run->selected_stroke == the_run->strokes.len - 1)
+            the_run->selected_stroke = the_run->strokes.len;
+    }
+
+    // The strokes are now owned by the run.
+    batch->strokes.len = 0;
+    drop_batch(batch);
+}
+
+static int64_t compare_run_mappings(const Run_Mapping& left, const Run_Mapping& right) {
+    return (int64_t)(left.run_id - right.run_id);
+}
+
+static Run_Info* lookup_run(Network_State* net, Game_State* game, uint64_t run_id) {
+    size_t index;
+    Run_Mapping fake_mapping = {run_id, 0};
+    bool found =
+        cz::binary_search(net->runs.as_slice(), fake_mapping, &index, compare_run_mappings);
+    CZ_ASSERT(found);
+    return &game->runs[net->runs[index].index];
+}
+
+template <class T>
+static void append_vector(cz::Vector<T>* vector, const cz::Vector<T>& other) {
+    vector->reserve(cz::heap_allocator(), other.len);
+    vector->append(other.as_slice());
+}
+
+/// Move the draw commands of `continuation` to the end of `stroke`.
+static void append_stroke(Stroke* stroke, Stroke* continuation) {
+    // Indices and offsets are relative to the stroke they are in.
+    for (size_t i = 0; i < continuation->segments.len; ++i) {
+        Segment& segment = continuation->segments[i];
+        if (segment.type == SEGMENT_CHUNK)
+            segment.index += (uint32_t)stroke->chunks.len;
+        else
+            segment.index += (uint32_t)stroke->blocks.len;
+    }
+    for (size_t i = 0; i < continuation->chunks.len; ++i) {
+        Chunk& chunk = continuation->chunks[i];
+        chunk.start += (uint32_t)stroke->cell_chars.len;
+        chunk.end += (uint32_t)stroke->cell_chars.len;
+    }
+    for (size_t i = 0; i < continuation->blocks.len; ++i) {
+        Block& block = continuation->blocks[i];
+        block.chars += stroke->data.len;
+        block.fgs += stroke->data.len;
+        block.bgs += stroke->data.len;
+    }
+
+    extend_bounds(&stroke->bounds, continuation->bounds);
+    append_vector(&stroke->segments, continuation->segments);
+    append_vector(&stroke->chunks, continuation->chunks);
+    append_vector(&stroke->blocks, continuation->blocks);
+    append_vector(&stroke->cell_dxs, continuation->cell_dxs);
+    append_vector(&stroke->cell_dys, continuation->cell_dys);
+    append_vector(&stroke->cell_colors, continuation->cell_colors);
+    append_vector(&stroke->cell_chars, continuation->cell_chars);
+    stroke->data.reserve(cz::heap_allocator(), continuation->data.len);
+    stroke->data.append(continuation->data);
+
+    drop_stroke(continuation);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
+// Module Code - network thread
+///////////////////////////////////////////////////////////////////////////////
+
+static void wait_for_activity(Network_State* net, cz::Vector<Client*>* ready, bool* accept);
+static Batch* get_batch(Client* client);
+
+static void network_thread_main(Network_State* net) {
+    cz::Vector<Client*> ready = {};
+    while (!net->stop) {
+        bool accept = false;
+        ready.len = 0;
+        wait_for_activity(net, &ready, &accept);
+
+        if (accept)
+            accept_clients(net);
+
+        // Service every client that has data in one pass so
+        // throughput scales with the number of clients.
+        for (size_t i = 0; i < ready.len; ++i) {
+            Client* client = ready[i];
+            bool open = receive(net, client);
+            if (!parse_messages(client))
+                open = false;
+            if (!open)
+                close_client(net, client);
+        }
+
+        // Publish everything parsed so far.  If the queue filled up
+        // on a previous iteration then this also retries those batches.
+        size_t published = 0;
+        for (; published < net->orphans.len; ++published) {
+            if (!net->queue.push(net->orphans[published]))
+                break;
+        }
+        net->orphans.remove_range(0, published);
+
+        bool any = (published > 0);
+        for (size_t i = 0; i < net->clients.len; ++i) {
+            any |= publish_batch(net, net->clients[i]);
+        }
+        if (any)
+            wake_main_thread(net);
+    }
+    ready.drop(cz::heap_allocator());
+}
 
-static size_t get_event_length(uint8_t type, cz::Str buffer);
-static netgridviz_context* lookup_context(Network_State* net, uint16_t context_id);
+/// Block until there is a new connection or data to read.  Wakes up periodically to check if
+/// the thread should be stopped.  Clients with data are put in `ready`.  If there are clients
+/// waiting to be accepted then `accept` is set to `true`.
+static void wait_for_activity(Network_State* net, cz::Vector<Client*>* ready, bool* accept) {
+#ifdef __linux__
+    struct epoll_event events[64];
+    int count = epoll_wait(net->epoll, events, sizeof(events) / sizeof(events[0]), 100);
+    for (int i = 0; i < count; ++i) {
+        Client* client = (Client*)events[i].data.ptr;
+        if (client) {
+            // Clients using shared memory have two file descriptors.
+            bool duplicate = false;
+            for (size_t j = 0; j < ready->len; ++j) {
+                if ((*ready)[j] == client)
+                    duplicate = true;
+            }
+            if (duplicate)
+                continue;
+            ready->reserve(cz::heap_allocator(), 1);
+            ready->push(client);
+        } else {
+            *accept = true;
+        }
+    }
+#else
+    fd_set set_read;
+    FD_ZERO(&set_read);
+    FD_SET(net->socket_server, &set_read);
+    SOCKET max = net->socket_server;
+    if (net->socket_unix != INVALID_SOCKET) {
+        FD_SET(net->socket_unix, &set_read);
+        if (net->socket_unix > max)
+            max = net->socket_unix;
+    }
+    for (size_t i = 0; i < net->clients.len; ++i) {
+        SOCKET socket = net->clients[i]->socket;
+        FD_SET(socket, &set_read);
+        if (socket > max)
+            max = socket;
+    }
+
+    struct timeval timeout = {};
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100000;
+    int count = select((int)(max + 1), &set_read, nullptr, nullptr, &timeout);
+    if (count <= 0)
+        return;
 
-void poll_network(Network_State* net, Game_State* game) {
-    actually_poll_server(net, game);
+    *accept = FD_ISSET(net->socket_server, &set_read);
+    if (net->socket_unix != INVALID_SOCKET && FD_ISSET(net->socket_unix, &set_read))
+        *accept = true;
+    for (size_t i = 0; i < net->clients.len; ++i) {
+        Client* client = net->clients[i];
+        if (FD_ISSET(client->socket, &set_read)) {
+            ready->reserve(cz::heap_allocator(), 1);
+            ready->push(client);
+        }
+    }
+#endif
+}
+
+/// Give the client's current batch to the main thread.  If the queue
+/// is full then we keep filling the current batch and try again later.
+static bool publish_batch(Network_State* net, Client* client) {
+    if (!client->batch)
+        return false;
+
+    if (!net->queue.push(client->batch))
+        return false;
+    client->batch = nullptr;
+    return true;
+}
+
+/// Interrupt the main thread if it is waiting for events.
+static void wake_main_thread(Network_State* net) {
+    if (net->wakeup_event == (uint32_t)-1)
+        return;
+    if (net->wakeup_pending.exchange(true))
+        return;
 
+    SDL_Event event = {};
+    event.type = net->wakeup_event;
+    SDL_PushEvent(&event);
+}
+
+static Batch* get_batch(Client* client) {
+    if (!client->batch) {
+        client->batch = cz::heap_allocator().alloc<Batch>();
+        *client->batch = {};
+        client->batch->run_id = client->run_id;
+    }
+    return client->batch;
+}
+
+/// Start a new stroke.  Strokes without a title are numbered.
+static void start_stroke(Client* client, cz::Str title) {
+    Batch* batch = get_batch(client);
+    size_t title_start = batch->titles.len;
+    if (title.len > 0) {
+        batch->titles.reserve(cz::heap_allocator(), title.len);
+        batch->titles.append(title);
+    } else {
+        cz::append(cz::heap_allocator(), &batch->titles, "Stroke ", client->num_strokes);
+    }
+    batch->title_starts.reserve(cz::heap_allocator(), 1);
+    batch->title_starts.push(title_start);
+
+    Stroke stroke = {};
+    // The buffer is set once the titles are moved into the run.
+    stroke.title.len = batch->titles.len - title_start;
+    stroke.bounds = empty_bounds();
+
+    batch->strokes.reserve(cz::heap_allocator(), 1);
+    batch->strokes.push(stroke);
+    client->num_strokes++;
+}
+
+/// Get the stroke that draw commands should be added to.
+static Stroke* current_stroke(Client* client) {
+    Batch* batch = get_batch(client);
+    if (batch->strokes.len == 0) {
+        if (client->num_strokes > 0) {
+            // The stroke was already published so continue it.
+            batch->continue_stroke = true;
+            batch->strokes.reserve(cz::heap_allocator(), 1);
+            Stroke stroke = {};
+            stroke.bounds = empty_bounds();
+            batch->strokes.push(stroke);
+            batch->title_starts.reserve(cz::heap_allocator(), 1);
+            batch->title_starts.push(batch->titles.len);
+        } else {
+            // Draw commands before the first stroke go in an implicit stroke.
+            start_stroke(client, {});
+        }
+    }
+    return &batch->strokes.last();
+}
+
+static Client_Context* lookup_context(Client* client, uint16_t context_id);
+static void respond_hello(Client* client, cz::Str message);
+static void push_char(Client* client, Client_Context* context, int64_t x, int64_t y, char ch);
+static void push_compact_char(Client* client, cz::Str message);
+static void push_block(Client* client, Client_Context* context, Block block, cz::Str payload);
+
+/// Returns `false` if the client sent a message that can't be parsed.
+static bool parse_messages(Client* client) {
+    // Consume messages by advancing a cursor and then remove them all at once at the end.
+    // Removing each message individually is quadratic in the number of bytes received.
+    size_t cursor = 0;
     while (1) {
-        if (net->buffer.len == 0)
+        cz::Str remaining = client->buffer.slice_start(cursor);
+        if (remaining.len == 0)
             break;
 
         uint8_t type = 0;
-        memcpy(&type, net->buffer.buffer, 1);
+        memcpy(&type, remaining.buffer, 1);
 
-        size_t length = get_event_length(type, net->buffer);
-        if (net->buffer.len < length)
+        size_t length = get_event_length(type, remaining);
+        if (length == invalid_event_length) {
+            client->buffer.remove_range(0, cursor);
+            return false;
+        }
+        if (remaining.len < length)
             break;
 
-        uint16_t context_id = 0;
-        memcpy(&context_id, net->buffer.buffer + 1, 2);
-        netgridviz_context* context = lookup_context(net, context_id);
+        cz::Str message = remaining.slice_end(length);
 
-        Run_Info* the_run = &game->runs.last();
+        // Most messages start with the context id.
+        Client_Context* context = nullptr;
+        if (type >= GRIDVIZ_SET_FG && type <= GRIDVIZ_SEND_GRID && type != GRIDVIZ_START_STROKE) {
+            uint16_t context_id = 0;
+            memcpy(&context_id, message.buffer + 1, 2);
+            context = lookup_context(client, context_id);
+        }
 
         switch (type) {
         case GRIDVIZ_SET_FG:
-            memcpy(&context->fg, net->buffer.buffer + 3, 3);
+            memcpy(&context->fg, message.buffer + 3, 3);
             break;
         case GRIDVIZ_SET_BG:
-            memcpy(&context->bg, net->buffer.buffer + 3, 3);
+            memcpy(&context->bg, message.buffer + 3, 3);
             break;
 
-        case GRIDVIZ_START_STROKE: {
-            if (net->reuse_first_stroke) {
-                net->reuse_first_stroke = false;
-            } else {
-                the_run->strokes.reserve(cz::heap_allocator(), 1);
-                the_run->strokes.push({});
-
-                // TODO pull out graphical stuff
-                if (the_run->selected_stroke == the_run->strokes.len - 1)
-                    the_run->selected_stroke = the_run->strokes.len;
-            }
-
-            cz::Str title;
-            if (length == 5) {
-                title = cz::format(cz::heap_allocator(), "Stroke ", the_run->strokes.len - 1);
-            } else {
-                title = net->buffer.slice(5, length).clone(cz::heap_allocator());
-            }
-            the_run->strokes.last().title = title;
-        } break;
+        case GRIDVIZ_START_STROKE:
+            start_stroke(client, message.slice(5, length));
+            break;
 
         case GRIDVIZ_SEND_CHAR: {
-            net->reuse_first_stroke = false;
-
             int64_t x = 0, y = 0;
             char ch = 0;
-            memcpy(&x, net->buffer.buffer + 3, sizeof(x));
-            memcpy(&y, net->buffer.buffer + 11, sizeof(y));
-            memcpy(&ch, net->buffer.buffer + 19, sizeof(ch));
-
-            Event event = {};
-            event.cp.type = EVENT_CHAR_POINT;
-            memcpy(event.cp.fg, context->fg, sizeof(context->fg));
-            memcpy(event.cp.bg, context->bg, sizeof(context->bg));
-            event.cp.ch = ch;
-            event.cp.x = x;
-            event.cp.y = y;
-
-            Stroke* stroke = &the_run->strokes.last();
-            stroke->events.reserve(cz::heap_allocator(), 1);
-            stroke->events.push(event);
+            memcpy(&x, message.buffer + 3, sizeof(x));
+            memcpy(&y, message.buffer + 11, sizeof(y));
+            memcpy(&ch, message.buffer + 19, sizeof(ch));
+            push_char(client, context, x, y, ch);
         } break;
 
+        case GRIDVIZ_SEND_STRING: {
+            Block block = {};
+            memcpy(&block.x, message.buffer + 3, sizeof(block.x));
+            memcpy(&block.y, message.buffer + 11, sizeof(block.y));
+            block.width = (uint32_t)(length - 23);
+            block.height = 1;
+            push_block(client, context, block, message.slice(23, length));
+        } break;
+
+        case GRIDVIZ_SEND_GRID: {
+            Block block = {};
+            memcpy(&block.x, message.buffer + 3, sizeof(block.x));
+            memcpy(&block.y, message.buffer + 11, sizeof(block.y));
+            memcpy(&block.width, message.buffer + 19, sizeof(block.width));
+            memcpy(&block.height, message.buffer + 23, sizeof(block.height));
+            uint8_t flags = 0;
+            memcpy(&flags, message.buffer + 27, sizeof(flags));
+            if (flags & GRIDVIZ_GRID_HAS_FG)
+                block.flags |= BLOCK_HAS_FG;
+            if (flags & GRIDVIZ_GRID_HAS_BG)
+                block.flags |= BLOCK_HAS_BG;
+            push_block(client, context, block, message.slice(28, length));
+        } break;
+
+        case GRIDVIZ_HELLO:
+            respond_hello(client, message);
+            break;
+
         default:
-            CZ_PANIC("invalid message type");
+            if (type & GRIDVIZ_COMPACT_CHAR) {
+                push_compact_char(client, message);
+            } else {
+                // `get_event_length` already rejected unknown message types.
+                CZ_PANIC("invalid message type");
+            }
             break;
         }
 
-        net->buffer.remove_range(0, length);
+        cursor += length;
+    }
+
+    client->buffer.remove_range(0, cursor);
+    return true;
+}
+
+/// Respond to `GRIDVIZ_HELLO` with the subset of the requested features that we support.
+static void respond_hello(Client* client, cz::Str message) {
+    uint32_t features = 0;
+    memcpy(&features, message.buffer + 1, sizeof(features));
+    uint32_t supported = GRIDVIZ_FEATURE_COMPACT;
+#ifdef __linux__
+    // The ring is attached to the hello message so we've already received it.
+    if (client->ring.header)
+        supported |= GRIDVIZ_FEATURE_SHARED_MEMORY;
+#endif
+    features &= supported;
+
+    uint8_t response[5] = {GRIDVIZ_HELLO};
+    memcpy(response + 1, &features, sizeof(features));
+
+    // The response is tiny so if it doesn't fit in the socket
+    // buffer then the client is broken and will timeout.
+    (void)send(client->socket, (const char*)response, sizeof(response), 0);
+}
+
+static bool lookup_color(Client* client, Client_Context* context, Palette_Index* index);
+
+static void push_char(Client* client, Client_Context* context, int64_t x, int64_t y, char ch) {
+    Palette_Index color;
+    if (!lookup_color(client, context, &color)) {
+        // The palette is full so store the colors directly.
+        Block block = {};
+        block.x = x;
+        block.y = y;
+        block.width = 1;
+        block.height = 1;
+        push_block(client, context, block, {&ch, 1});
+        return;
     }
+
+    Stroke* stroke = current_stroke(client);
+
+    // Continue the previous chunk if the cell is close enough to be stored as an offset.
+    Chunk* chunk = nullptr;
+    if (stroke->segments.len > 0 && stroke->segments.last().type == SEGMENT_CHUNK) {
+        chunk = &stroke->chunks[stroke->segments.last().index];
+        int64_t dx = x - chunk->x;
+        int64_t dy = y - chunk->y;
+        if (dx < INT16_MIN || dx > INT16_MAX || dy < INT16_MIN || dy > INT16_MAX)
+            chunk = nullptr;
+        else if (chunk->end - chunk->start == max_chunk_cells)
+            chunk = nullptr;
+    }
+
+    if (!chunk) {
+        Chunk new_chunk = {};
+        new_chunk.x = x;
+        new_chunk.y = y;
+        new_chunk.start = (uint32_t)stroke->cell_chars.len;
+        new_chunk.end = new_chunk.start;
+
+        Segment segment = {};
+        segment.type = SEGMENT_CHUNK;
+        segment.index = (uint32_t)stroke->chunks.len;
+
+        stroke->chunks.reserve(cz::heap_allocator(), 1);
+        stroke->chunks.push(new_chunk);
+        stroke->segments.reserve(cz::heap_allocator(), 1);
+        stroke->segments.push(segment);
+        chunk = &stroke->chunks.last();
+    }
+
+    stroke->cell_dxs.reserve(cz::heap_allocator(), 1);
+    stroke->cell_dys.reserve(cz::heap_allocator(), 1);
+    stroke->cell_colors.reserve(cz::heap_allocator(), 1);
+    stroke->cell_chars.reserve(cz::heap_allocator(), 1);
+    int16_t dx = (int16_t)(x - chunk->x);
+    int16_t dy = (int16_t)(y - chunk->y);
+    stroke->cell_dxs.push(dx);
+    stroke->cell_dys.push(dy);
+    stroke->cell_colors.push(color);
+    stroke->cell_chars.push((uint8_t)ch);
+    chunk->end++;
+
+    chunk->min_dx = cz::min(chunk->min_dx, dx);
+    chunk->min_dy = cz::min(chunk->min_dy, dy);
+    chunk->max_dx = cz::max(chunk->max_dx, dx);
+    chunk->max_dy = cz::max(chunk->max_dy, dy);
+    extend_bounds(&stroke->bounds, {x, y, x, y});
 }
 
-static size_t get_event_length(uint8_t type, cz::Str buffer) {
-    switch (type) {
-    case GRIDVIZ_SET_FG:
-    case GRIDVIZ_SET_BG:
-        return 6;
-    case GRIDVIZ_START_STROKE: {
-        if (buffer.len < 5)
-            return 5;
-        uint32_t title_len;
-        memcpy(&title_len, buffer.buffer + 1, sizeof(title_len));
-        return 5 + (size_t)title_len;
+static int64_t compare_palette_entries(const Palette_Entry& left, const Palette_Entry& right) {
+    return memcmp(&left.colors, &right.colors, sizeof(Color_Pair));
+}
+
+/// Find the context's colors in the run's palette, adding them if they aren't
+/// there.  Returns `false` if the colors aren't there and the palette is full.
+static bool lookup_color(Client* client, Client_Context* context, Palette_Index* index) {
+    Palette_Entry entry = {};
+    memcpy(entry.colors.fg, context->fg, sizeof(context->fg));
+    memcpy(entry.colors.bg, context->bg, sizeof(context->bg));
+
+    if (client->has_last_color && compare_palette_entries(client->last_color, entry) == 0) {
+        *index = client->last_color.index;
+        return true;
     }
-    case GRIDVIZ_SEND_CHAR:
-        return 20;
-    default:
-        CZ_PANIC("invalid message type");
-        break;
+
+    size_t position;
+    if (!cz::binary_search(client->palette.as_slice(), entry, &position,
+                           compare_palette_entries)) {
+        if (client->palette.len == max_palette_size)
+            return false;
+
+        entry.index = (Palette_Index)client->palette.len;
+        client->palette.reserve(cz::heap_allocator(), 1);
+        client->palette.insert(position, entry);
+
+        Batch* batch = get_batch(client);
+        batch->new_colors.reserve(cz::heap_allocator(), 1);
+        batch->new_colors.push(entry.colors);
+    }
+
+    client->last_color = client->palette[position];
+    client->has_last_color = true;
+    *index = client->last_color.index;
+    return true;
+}
+
+static void push_compact_char(Client* client, cz::Str message) {
+    uint8_t type = message[0];
+    size_t index = 1;
+
+    uint64_t context_id = client->last_context_id;
+    if (!(type & GRIDVIZ_COMPACT_SAME_CONTEXT))
+        (void)read_varint(message, &index, &context_id);
+    client->last_context_id = (uint16_t)context_id;
+    Client_Context* context = lookup_context(client, client->last_context_id);
+
+    // Use unsigned math so overflow wraps.
+    uint64_t dx = 1, dy = 0;
+    if (!(type & GRIDVIZ_COMPACT_NEXT_CELL)) {
+        uint64_t value;
+        (void)read_varint(message, &index, &value);
+        dx = (uint64_t)zigzag_decode(value);
+        (void)read_varint(message, &index, &value);
+        dy = (uint64_t)zigzag_decode(value);
+    }
+    context->x = (int64_t)((uint64_t)context->x + dx);
+    context->y = (int64_t)((uint64_t)context->y + dy);
+
+    push_char(client, context, context->x, context->y, (char)message[index]);
+}
+
+/// Store a string or grid in the current stroke.  `payload` is the
+/// characters followed by the optional per cell colors.
+static void push_block(Client* client, Client_Context* context, Block block, cz::Str payload) {
+    Stroke* stroke = current_stroke(client);
+
+    memcpy(block.fg, context->fg, sizeof(context->fg));
+    memcpy(block.bg, context->bg, sizeof(context->bg));
+
+    size_t cells = (size_t)block.width * (size_t)block.height;
+    size_t cell_size = 1 + ((block.flags & BLOCK_HAS_FG) ? 3 : 0) +
+                       ((block.flags & BLOCK_HAS_BG) ? 3 : 0);
+    CZ_ASSERT(payload.len == cells * cell_size);
+
+    block.chars = stroke->data.len;
+    block.fgs = block.chars + cells;
+    block.bgs = block.fgs + ((block.flags & BLOCK_HAS_FG) ? cells * 3 : 0);
+
+    if (cells > 0) {
+        Bounds bounds = {block.x, block.y, block.x + block.width - 1, block.y + block.height - 1};
+        extend_bounds(&stroke->bounds, bounds);
     }
+
+    stroke->data.reserve(cz::heap_allocator(), payload.len);
+    stroke->data.append(payload);
+
+    Segment segment = {};
+    segment.type = SEGMENT_BLOCK;
+    segment.index = (uint32_t)stroke->blocks.len;
+
+    stroke->blocks.reserve(cz::heap_allocator(), 1);
+    stroke->blocks.push(block);
+    stroke->segments.reserve(cz::heap_allocator(), 1);
+    stroke->segments.push(segment);
 }
 
-static int64_t compare_contexts(const netgridviz_context& left, const netgridviz_context& right) {
+static int64_t compare_contexts(const Client_Context& left, const Client_Context& right) {
     return (int64_t)left.id - (int64_t)right.id;
 }
 
-static netgridviz_context* lookup_context(Network_State* net, uint16_t context_id) {
+static Client_Context* lookup_context(Client* client, uint16_t context_id) {
     // Use binary search because we want to handle crazy id number inputs without mallocing
     // a rediculous amount of memory.  Performance of this function isn't that important.
     size_t index;
-    netgridviz_context fake_context = {};
+    Client_Context fake_context = {};
     fake_context.id = context_id;
-    if (!cz::binary_search(net->contexts.as_slice(), fake_context, &index, compare_contexts)) {
-        net->contexts.reserve(cz::heap_allocator(), 1);
-        net->contexts.insert(index, netgridviz_make_context(context_id));
+    if (!cz::binary_search(client->contexts.as_slice(), fake_context, &index, compare_contexts)) {
+        netgridviz_context initial = netgridviz_make_context(context_id);
+        Client_Context context = {};
+        context.id = context_id;
+        memcpy(context.fg, initial.fg, sizeof(initial.fg));
+        memcpy(context.bg, initial.bg, sizeof(initial.bg));
+
+        client->contexts.reserve(cz::heap_allocator(), 1);
+        client->contexts.insert(index, context);
     }
 
-    return &net->contexts[index];
+    return &client->contexts[index];
 }
 
-static void actually_poll_server(Network_State* net, Game_State* game) {
-    if (!net->running) {
-        return;
-    }
+static ssize_t receive_some(Network_State* net, Client* client, char* buffer, size_t len);
+static size_t drain_ring(Client* client, size_t max);
 
-    if (net->socket_client != INVALID_SOCKET) {
-        // Reserve 2048 + 1 so the first time we get to 4k but we don't loop and bump to 8k.
-        net->buffer.reserve(cz::heap_allocator(), 2049);
+/// Read everything available from the client.  Returns `false` if the client disconnected.
+static bool receive(Network_State* net, Client* client) {
+    // Drain the socket so ingest speed isn't tied to how often we wake up.  Stop after
+    // a fixed number of bytes so one fast client can't starve the other clients.
+    bool open = true;
+    size_t received = 0;
+    while (received < max_receive_per_poll) {
+        client->buffer.reserve(cz::heap_allocator(), receive_chunk_size);
 
         ssize_t result =
-            recv(net->socket_client, net->buffer.end(), (len_t)net->buffer.remaining(), 0);
+            receive_some(net, client, client->buffer.end(), client->buffer.remaining());
         if (result > 0) {
-            net->buffer.len += result;
+            client->buffer.len += result;
+            received += result;
         } else if (result == 0) {
-            closesocket(net->socket_client);
-            net->socket_client = INVALID_SOCKET;
+            open = false;
+            break;
         } else {
-            // Ignore errors.
+            // Either there is no more data or an error occurred.  Ignore errors.
+            break;
         }
-    } else {
-        SOCKET client = accept(net->socket_server, nullptr, nullptr);
-        if (client == INVALID_SOCKET)
+    }
+
+    // The client writes everything to the ring before closing the socket so
+    // if the socket is closed then we have to read the entire ring now.
+    if (received < max_receive_per_poll || !open)
+        received += drain_ring(client, open ? max_receive_per_poll - received : SIZE_MAX);
+
+    return open;
+}
+
+static void attach_ring(Network_State* net, Client* client, int memfd, int eventfd);
+
+static ssize_t receive_some(Network_State* net, Client* client, char* buffer, size_t len) {
+#ifdef __linux__
+    if (client->is_unix) {
+        // The shared memory ring's file descriptors are attached to the hello message.
+        struct iovec iov;
+        iov.iov_base = buffer;
+        iov.iov_len = len;
+
+        union {
+            struct cmsghdr header;
+            char buffer[CMSG_SPACE(2 * sizeof(int))];
+        } control;
+
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        ssize_t result = recvmsg(client->socket, &msg, MSG_CMSG_CLOEXEC);
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int fds[2];
+            if (count == 2) {
+                memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+                attach_ring(net, client, fds[0], fds[1]);
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                    close(fd);
+                }
+            }
+        }
+        return result;
+    }
+#endif
+
+    return recv(client->socket, buffer, (len_t)len, 0);
+}
+
+/// Map the client's shared memory ring.  Takes ownership of the file descriptors.
+static void attach_ring(Network_State* net, Client* client, int memfd, int eventfd) {
+#ifdef __linux__
+    if (client->ring.header)
+        goto error;
+
+    {
+        // If the client could shrink the memfd then touching the mapping would crash us.
+        int seals = fcntl(memfd, F_GET_SEALS);
+        if (seals < 0 || !(seals & F_SEAL_SHRINK))
+            goto error;
+
+        struct stat info;
+        if (fstat(memfd, &info) < 0 || (size_t)info.st_size < sizeof(gridviz_ring_header))
+            goto error;
+
+        size_t size = (size_t)info.st_size;
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (memory == MAP_FAILED)
+            goto error;
+
+        // Don't trust the client to describe the ring correctly.
+        Ring_Reader ring;
+        if (!open_ring_reader(&ring, memory, size)) {
+            munmap(memory, size);
+            goto error;
+        }
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        if (epoll_ctl(net->epoll, EPOLL_CTL_ADD, eventfd, &event) < 0) {
+            munmap(memory, size);
+            goto error;
+        }
+
+        close(memfd);
+        client->ring = ring;
+        client->ring_size = size;
+        client->ring_eventfd = eventfd;
+        return;
+    }
+
+error:
+    close(memfd);
+    close(eventfd);
+#endif
+}
+
+/// Copy up to `max` bytes from the shared memory ring into the client's buffer.
+static size_t drain_ring(Client* client, size_t max) {
+#ifdef __linux__
+    Ring_Reader* ring = &client->ring;
+    if (!ring->header)
+        return 0;
+
+    gridviz_ring_header* header = ring->header;
+    size_t received = 0;
+
+    __atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+    while (1) {
+        uint64_t available;
+        if (!ring_available(ring, &available)) {
+            // The client corrupted the ring.  Ignore everything in it.
+            return received;
+        }
+
+        if (available == 0) {
+            // Reset the eventfd and then tell the client to wake us up.  Check again
+            // afterwards in case the client wrote before seeing `consumer_waiting`.
+            uint64_t ignored;
+            (void)read(client->ring_eventfd, &ignored, sizeof(ignored));
+            __atomic_store_n(&header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&header->tail, __ATOMIC_SEQ_CST) == ring->head)
+                break;
+            __atomic_store_n(&header->consumer_waiting, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (received >= max) {
+            // Leave the rest for later.  `consumer_waiting` is clear so the client won't
+            // signal the eventfd and it may have been reset above.  Signal it ourselves
+            // so epoll wakes us up to read the rest.
+            uint64_t one = 1;
+            (void)write(client->ring_eventfd, &one, sizeof(one));
+            break;
+        }
+
+        size_t count = (size_t)available;
+        if (count > max - received)
+            count = max - received;
+        read_ring(ring, &client->buffer, count);
+        received += count;
+    }
+    return received;
+#else
+    return 0;
+#endif
+}
+
+static void accept_from(Network_State* net, SOCKET server, bool is_unix);
+
+static void accept_clients(Network_State* net) {
+    accept_from(net, net->socket_server, false);
+    if (net->socket_unix != INVALID_SOCKET)
+        accept_from(net, net->socket_unix, true);
+}
+
+static void accept_from(Network_State* net, SOCKET server, bool is_unix) {
+    while (1) {
+        SOCKET socket = accept(server, nullptr, nullptr);
+        if (socket == INVALID_SOCKET)
             return;
 
-        int result = make_non_blocking(client);
+        int result = make_non_blocking(socket);
         if (result == SOCKET_ERROR) {
-            closesocket(client);
-            return;
+            closesocket(socket);
+            continue;
         }
 
-        // Start a new client connection.
-        net->socket_client = client;
-        net->contexts.len = 0;
-        net->reuse_first_stroke = true;
+#ifndef __linux__
+        // select can only wait on a fixed number of sockets.
+        if (net->clients.len + 2 >= FD_SETSIZE) {
+            closesocket(socket);
+            continue;
+        }
+#endif
 
-        // Create a new run and select it.
-        Run_Info the_run = {};
-        the_run.strokes.reserve(cz::heap_allocator(), 1);
-        the_run.strokes.push({"Stroke 0"});
-        // TODO pull out graphical stuff
-        the_run.selected_stroke = 1;
-        the_run.font_size = 14;
-        the_run.off_x = 10;
-        the_run.off_y = 10;
+        Client* client = cz::heap_allocator().alloc<Client>();
+        *client = {};
+        client->socket = socket;
+        client->is_unix = is_unix;
+#ifdef __linux__
+        client->ring_eventfd = -1;
+#endif
+        client->run_id = net->next_run_id++;
+        client->buffer.reserve(cz::heap_allocator(), receive_chunk_size);
+
+#ifdef __linux__
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        result = epoll_ctl(net->epoll, EPOLL_CTL_ADD, socket, &event);
+        if (result < 0) {
+            drop_client(client);
+            continue;
+        }
+#endif
+
+        net->clients.reserve(cz::heap_allocator(), 1);
+        net->clients.push(client);
+
+        // Tell the main thread to create a new run.
+        Batch* batch = get_batch(client);
+        batch->new_run = true;
         std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
         time_t time = std::chrono::system_clock::to_time_t(now);
-        the_run.start_time = cz::time_t_to_date_local(time);
-        game->runs.reserve(cz::heap_allocator(), 1);
-        game->runs.push(the_run);
-        game->selected_run = game->runs.len - 1;
+        batch->start_time = cz::time_t_to_date_local(time);
+    }
+}
+
+static void close_client(Network_State* net, Client* client) {
+    // Hand off whatever is left.  If the queue is full then publish it later.
+    if (publish_batch(net, client))
+        wake_main_thread(net);
+    if (client->batch) {
+        net->orphans.reserve(cz::heap_allocator(), 1);
+        net->orphans.push(client->batch);
+        client->batch = nullptr;
+    }
+
+#ifdef __linux__
+    (void)epoll_ctl(net->epoll, EPOLL_CTL_DEL, client->socket, nullptr);
+    if (client->ring_eventfd != -1)
+        (void)epoll_ctl(net->epoll, EPOLL_CTL_DEL, client->ring_eventfd, nullptr);
+#endif
+
+    for (size_t i = 0; i < net->clients.len; ++i) {
+        if (net->clients[i] == client) {
+            net->clients.remove(i);
+            break;
+        }
     }
+
+    drop_client(client);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - benchmarking
+///////////////////////////////////////////////////////////////////////////////
+
+bool parse_burst(cz::Str bytes) {
+    Client* client = cz::heap_allocator().alloc<Client>();
+    *client = {};
+    client->socket = INVALID_SOCKET;
+#ifdef __linux__
+    client->ring_eventfd = -1;
+#endif
+    client->buffer.reserve_exact(cz::heap_allocator(), bytes.len);
+    client->buffer.append(bytes);
+
+    bool ok = parse_messages(client);
+    drop_client(client);
+    return ok;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1,12 +1,20 @@
 #pragma once
 
+#include <cz/str.hpp>
+
 namespace gridviz {
 
 struct Network_State;
 struct Game_State;
 
 Network_State* start_networking(int port);
-void poll_network(Network_State* net, Game_State* game);
-void stop_networking(Network_State* net);
+/// Move the data received by the network thread into the game.  Returns true if anything changed.
+bool poll_network(Network_State* net, Game_State* game);
+/// Stop the network thread and move everything it received into the game.
+void stop_networking(Network_State* net, Game_State* game);
+
+/// Parse `bytes` as if one client sent them all at once and drop the result.
+/// Returns `false` if they are malformed.  Used by `benchmark-ingest`.
+bool parse_burst(cz::Str bytes);
 
 }
@@ -0,0 +1,890 @@
+#include "session.hpp"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <Tracy.hpp>
+#include <cz/defer.hpp>
+#include <cz/format.hpp>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+
+#include "grid.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace gridviz {
+
+static void start_recording(Run_Info* run, cz::Str directory, size_t run_index);
+static void record_run(Run_Info* run, size_t end);
+static bool write_record(Session* session, uint8_t type, cz::Str payload);
+static bool read_index(Session* session, Run_Info* run, uint64_t file_size);
+static bool scan_records(Session* session, Run_Info* run, uint64_t file_size);
+static bool map_session(Session* session, uint64_t size);
+static void unmap_session(Session* session);
+static bool parse_stroke(cz::Str record, size_t num_colors, Stroke* stroke);
+static bool valid_stroke(const Stroke* stroke, size_t num_colors);
+static size_t stroke_memory(const Stroke* stroke);
+static void evict_stroke(Session* session, Stroke* stroke, size_t index);
+
+/// Incremented by `trim_sessions` so it knows which strokes were used recently.
+static uint64_t current_frame;
+
+static const char session_magic[8] = {'g', 'r', 'i', 'd', 'v', 'i', 'z', 'S'};
+static const char index_magic[8] = {'g', 'r', 'i', 'd', 'v', 'i', 'z', 'I'};
+
+/// Draw commands are written the way they are laid out in memory.  Files from builds that
+/// lay them out differently are rejected.  The top byte is the version of the format.
+static const uint32_t session_layout =
+    (uint32_t)(sizeof(Segment) | sizeof(Chunk) << 8 | sizeof(Block) << 16 | 1 << 24);
+
+enum Record_Type {
+    RECORD_COLORS = 1,
+    RECORD_STROKE = 2,
+    RECORD_INDEX = 3,
+};
+
+/// The magic, the layout and the six fields of the start time.
+static const size_t session_header_size = 8 + 4 + 6 * 4;
+/// The type and the size of the payload.
+static const size_t record_header_size = 1 + 8;
+/// The offset of the index record and the magic at the end of the file.
+static const size_t index_trailer_size = 8 + 8;
+/// The offset, bounds and title length of a stroke in the index.
+static const size_t index_entry_size = 8 + sizeof(Bounds) + 4;
+/// The bounds and title length at the start of a stroke record.
+static const size_t stroke_prefix_size = sizeof(Bounds) + 4;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - encoding
+///////////////////////////////////////////////////////////////////////////////
+
+static void put(cz::String* buffer, const void* data, size_t size) {
+    buffer->reserve(cz::heap_allocator(), size);
+    buffer->append({(const char*)data, size});
+}
+
+template <class T>
+static void put_value(cz::String* buffer, const T& value) {
+    put(buffer, &value, sizeof(T));
+}
+
+template <class T>
+static void put_vector(cz::String* buffer, const cz::Vector<T>& vector) {
+    put(buffer, vector.elems, vector.len * sizeof(T));
+}
+
+/// Reads values out of a buffer.  Reading past the end clears `ok` instead of crashing.
+struct Reader {
+    const char* data;
+    size_t len;
+    size_t pos;
+    bool ok;
+};
+
+static bool take(Reader* reader, void* out, size_t size) {
+    if (!reader->ok || reader->len - reader->pos < size) {
+        reader->ok = false;
+        memset(out, 0, size);
+        return false;
+    }
+    memcpy(out, reader->data + reader->pos, size);
+    reader->pos += size;
+    return true;
+}
+
+template <class T>
+static T take_value(Reader* reader) {
+    T value;
+    take(reader, &value, sizeof(T));
+    return value;
+}
+
+static cz::Str take_str(Reader* reader, size_t size) {
+    if (!reader->ok || reader->len - reader->pos < size) {
+        reader->ok = false;
+        return {};
+    }
+    cz::Str str = {reader->data + reader->pos, size};
+    reader->pos += size;
+    return str;
+}
+
+template <class T>
+static void take_vector(Reader* reader, cz::Vector<T>* vector, size_t count) {
+    vector->len = 0;
+    if (!reader->ok || (reader->len - reader->pos) / sizeof(T) < count) {
+        reader->ok = false;
+        return;
+    }
+    vector->reserve_exact(cz::heap_allocator(), count);
+    memcpy(vector->elems, reader->data + reader->pos, count * sizeof(T));
+    vector->len = count;
+    reader->pos += count * sizeof(T);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - files
+///////////////////////////////////////////////////////////////////////////////
+
+static bool seek_file(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, (int64_t)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static uint64_t get_file_size(FILE* file) {
+#ifdef _WIN32
+    if (_fseeki64(file, 0, SEEK_END) != 0)
+        return 0;
+    return (uint64_t)_ftelli64(file);
+#else
+    if (fseeko(file, 0, SEEK_END) != 0)
+        return 0;
+    return (uint64_t)ftello(file);
+#endif
+}
+
+/// Read `size` bytes at `offset` into `buffer`, replacing its contents.
+static bool read_at(FILE* file, uint64_t offset, size_t size, cz::String* buffer) {
+    buffer->len = 0;
+    buffer->reserve_exact(cz::heap_allocator(), size);
+    if (!seek_file(file, offset))
+        return false;
+    if (fread(buffer->buffer, 1, size, file) != size)
+        return false;
+    buffer->len = size;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - lifetime
+///////////////////////////////////////////////////////////////////////////////
+
+void drop_session(Session* session) {
+    unmap_session(session);
+    if (session->file)
+        fclose(session->file);
+    if (session->worker_file)
+        fclose(session->worker_file);
+    session->path.drop(cz::heap_allocator());
+    session->offsets.drop(cz::heap_allocator());
+    session->resident.drop(cz::heap_allocator());
+    session->last_used.drop(cz::heap_allocator());
+    session->index.drop(cz::heap_allocator());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - recording
+///////////////////////////////////////////////////////////////////////////////
+
+void record_sessions(Game_State* game, cz::Str directory) {
+    for (size_t i = 0; i < game->runs.len; ++i) {
+        Run_Info* run = &game->runs[i];
+        if (!run->session)
+            start_recording(run, directory, i);
+
+        Session* session = run->session;
+        if (session->reading || !session->file)
+            continue;
+
+        // The last stroke can still be added to by the client.
+        size_t stored = session->resident.len;
+        if (run->strokes.len <= stored + 1)
+            continue;
+
+        ZoneScoped;
+        size_t offsets_len = session->offsets.len;
+        uint64_t stored_end = (offsets_len > 0 ? session->offsets.last() : 0);
+        record_run(run, run->strokes.len - 1);
+
+        // Make sure the strokes survive if we crash.  Strokes are only backed by the
+        // file once they are flushed since the mapping can only see what was written.
+        if (session->file && fflush(session->file) != 0) {
+            fprintf(stderr, "Failed to record session to %s: %s\n", session->path.buffer,
+                    strerror(errno));
+            fclose(session->file);
+            session->file = nullptr;
+        }
+        if (!session->file) {
+            // Strokes that didn't make it to the file stay in memory.
+            session->offsets.len = offsets_len;
+            if (offsets_len > 0)
+                session->offsets.last() = stored_end;
+            continue;
+        }
+
+        size_t count = session->offsets.len - 1;
+        session->resident.reserve(cz::heap_allocator(), count - stored);
+        session->last_used.reserve(cz::heap_allocator(), count - stored);
+        for (size_t s = stored; s < count; ++s) {
+            session->resident.push(true);
+            session->last_used.push(current_frame);
+            session->resident_memory += stroke_memory(&run->strokes[s]);
+        }
+    }
+}
+
+static void start_recording(Run_Info* run, cz::Str directory, size_t run_index) {
+    Session* session = cz::heap_allocator().alloc<Session>();
+    *session = {};
+    run->session = session;
+
+    const cz::Date& date = run->start_time;
+    char name[64];
+    snprintf(name, sizeof(name), "gridviz-%04d%02d%02d-%02d%02d%02d-%zu.gvs", date.year,
+             date.month, date.day_of_month, date.hour, date.minute, date.second, run_index);
+    session->path = cz::format(cz::heap_allocator(), directory, '/', name);
+
+    session->file = fopen(session->path.buffer, "wb");
+    if (!session->file) {
+        fprintf(stderr, "Failed to record session to %s: %s\n", session->path.buffer,
+                strerror(errno));
+        return;
+    }
+
+    cz::String header = {};
+    CZ_DEFER(header.drop(cz::heap_allocator()));
+    put(&header, session_magic, sizeof(session_magic));
+    put_value(&header, session_layout);
+    int32_t fields[6] = {date.year, date.month, date.day_of_month,
+                         date.hour, date.minute, date.second};
+    put(&header, fields, sizeof(fields));
+
+    if (fwrite(header.buffer, 1, header.len, session->file) != header.len) {
+        fprintf(stderr, "Failed to record session to %s: %s\n", session->path.buffer,
+                strerror(errno));
+        fclose(session->file);
+        session->file = nullptr;
+        return;
+    }
+    session->end = header.len;
+
+    // Evicted strokes are read back through their own handle.
+    session->worker_file = fopen(session->path.buffer, "rb");
+    if (!session->worker_file) {
+        fprintf(stderr, "Failed to record session to %s: %s\n", session->path.buffer,
+                strerror(errno));
+        fclose(session->file);
+        session->file = nullptr;
+    }
+}
+
+/// Write the colors added since the last call and the strokes before `end`.
+static void record_run(Run_Info* run, size_t end) {
+    Session* session = run->session;
+
+    if (session->colors_written < run->palette.len) {
+        cz::Slice<Color_Pair> colors = run->palette.slice_start(session->colors_written);
+        cz::Str payload = {(const char*)colors.elems, colors.len * sizeof(Color_Pair)};
+        if (!write_record(session, RECORD_COLORS, payload))
+            return;
+        session->colors_written = run->palette.len;
+    }
+
+    // The end of the last record is replaced by the records of the new strokes.
+    uint64_t stroke_end = 0;
+    if (session->offsets.len > 0)
+        stroke_end = session->offsets.pop();
+
+    cz::String payload = {};
+    CZ_DEFER(payload.drop(cz::heap_allocator()));
+    for (size_t i = session->offsets.len; i < end; ++i) {
+        const Stroke* stroke = &run->strokes[i];
+        payload.len = 0;
+        put_value(&payload, stroke->bounds);
+        put_value(&payload, (uint32_t)stroke->title.len);
+        put(&payload, stroke->title.buffer, stroke->title.len);
+        uint32_t counts[5] = {(uint32_t)stroke->segments.len, (uint32_t)stroke->chunks.len,
+                              (uint32_t)stroke->blocks.len, (uint32_t)stroke->data.len,
+                              (uint32_t)stroke->cell_chars.len};
+        put(&payload, counts, sizeof(counts));
+        put_vector(&payload, stroke->segments);
+        put_vector(&payload, stroke->chunks);
+        put_vector(&payload, stroke->blocks);
+        put(&payload, stroke->data.buffer, stroke->data.len);
+        put_vector(&payload, stroke->cell_dxs);
+        put_vector(&payload, stroke->cell_dys);
+        put_vector(&payload, stroke->cell_colors);
+        put_vector(&payload, stroke->cell_chars);
+
+        uint64_t offset = session->end;
+        if (!write_record(session, RECORD_STROKE, payload))
+            return;
+        session->offsets.reserve(cz::heap_allocator(), 2);
+        session->offsets.push(offset);
+        stroke_end = session->end;
+    }
+
+    if (session->offsets.len > 0)
+        session->offsets.push(stroke_end);
+}
+
+/// Append a record.  Recording stops if writing fails.
+static bool write_record(Session* session, uint8_t type, cz::Str payload) {
+    char header[record_header_size];
+    uint64_t size = payload.len;
+    header[0] = (char)type;
+    memcpy(header + 1, &size, sizeof(size));
+
+    if (fwrite(header, 1, sizeof(header), session->file) != sizeof(header) ||
+        fwrite(payload.buffer, 1, payload.len, session->file) != payload.len) {
+        fprintf(stderr, "Failed to record session to %s: %s\n", session->path.buffer,
+                strerror(errno));
+        fclose(session->file);
+        session->file = nullptr;
+        return false;
+    }
+
+    session->end += sizeof(header) + payload.len;
+    return true;
+}
+
+void finish_sessions(Game_State* game) {
+    for (size_t i = 0; i < game->runs.len; ++i) {
+        Run_Info* run = &game->runs[i];
+        Session* session = run->session;
+        if (!session || session->reading || !session->file)
+            continue;
+
+        record_run(run, run->strokes.len);
+        if (!session->file)
+            continue;
+
+        // Titles and bounds are stored again so opening doesn't have to read every stroke.
+        uint64_t index_offset = session->end;
+        cz::String payload = {};
+        CZ_DEFER(payload.drop(cz::heap_allocator()));
+        put_value(&payload, (uint64_t)run->strokes.len);
+        put_value(&payload, (uint64_t)run->palette.len);
+        put_vector(&payload, run->palette);
+        for (size_t s = 0; s < run->strokes.len; ++s) {
+            put_value(&payload, session->offsets[s]);
+            put_value(&payload, run->strokes[s].bounds);
+            put_value(&payload, (uint32_t)run->strokes[s].title.len);
+        }
+        for (size_t s = 0; s < run->strokes.len; ++s) {
+            put(&payload, run->strokes[s].title.buffer, run->strokes[s].title.len);
+        }
+        if (!write_record(session, RECORD_INDEX, payload))
+            continue;
+
+        char trailer[index_trailer_size];
+        memcpy(trailer, &index_offset, sizeof(index_offset));
+        memcpy(trailer + 8, index_magic, sizeof(index_magic));
+        if (fwrite(trailer, 1, sizeof(trailer), session->file) != sizeof(trailer) ||
+            fclose(session->file) != 0) {
+            fprintf(stderr, "Failed to record session to %s: %s\n", session->path.buffer,
+                    strerror(errno));
+        }
+        session->file = nullptr;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - opening
+///////////////////////////////////////////////////////////////////////////////
+
+bool open_session(Game_State* game, const char* path) {
+    ZoneScoped;
+
+    Session* session = cz::heap_allocator().alloc<Session>();
+    *session = {};
+    session->reading = true;
+    session->path = cz::Str{path}.clone_null_terminate(cz::heap_allocator());
+
+    Run_Info run = {};
+    bool ok = false;
+    CZ_DEFER(if (!ok) {
+        run.strokes.drop(cz::heap_allocator());
+        run.palette.drop(cz::heap_allocator());
+        drop_session(session);
+        cz::heap_allocator().dealloc(session);
+    });
+
+    session->file = fopen(path, "rb");
+    if (!session->file) {
+        fprintf(stderr, "Failed to open session %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    cz::String header = {};
+    CZ_DEFER(header.drop(cz::heap_allocator()));
+    if (!read_at(session->file, 0, session_header_size, &header) ||
+        memcmp(header.buffer, session_magic, sizeof(session_magic)) != 0) {
+        fprintf(stderr, "Failed to open session %s: not a session\n", path);
+        return false;
+    }
+
+    Reader reader = {header.buffer, header.len, sizeof(session_magic), true};
+    if (take_value<uint32_t>(&reader) != session_layout) {
+        fprintf(stderr, "Failed to open session %s: recorded by an incompatible version\n",
+                path);
+        return false;
+    }
+    int32_t fields[6];
+    take(&reader, fields, sizeof(fields));
+    run.start_time.year = fields[0];
+    run.start_time.month = fields[1];
+    run.start_time.day_of_month = fields[2];
+    run.start_time.hour = fields[3];
+    run.start_time.minute = fields[4];
+    run.start_time.second = fields[5];
+
+    // Sessions that weren't finished don't have an index so find the strokes the slow way.
+    uint64_t file_size = get_file_size(session->file);
+    if (!read_index(session, &run, file_size) && !scan_records(session, &run, file_size)) {
+        fprintf(stderr, "Failed to open session %s: corrupt\n", path);
+        return false;
+    }
+
+    // Nothing is read until it is used.
+    size_t count = run.strokes.len;
+    session->resident.reserve_exact(cz::heap_allocator(), count);
+    session->resident.len = count;
+    memset(session->resident.elems, 0, count * sizeof(bool));
+    session->last_used.reserve_exact(cz::heap_allocator(), count);
+    session->last_used.len = count;
+    memset(session->last_used.elems, 0, count * sizeof(uint64_t));
+
+    session->worker_file = fopen(path, "rb");
+    if (!session->worker_file) {
+        fprintf(stderr, "Failed to open session %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (count > 0 && !map_session(session, session->offsets.last())) {
+        fprintf(stderr, "Failed to open session %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // Start at the beginning since showing the end would have to read every stroke.
+    run.selected_stroke = 0;
+    run.font_size = 14;
+    run.off_x = 10;
+    run.off_y = 10;
+    run.session = session;
+    game->runs.reserve(cz::heap_allocator(), 1);
+    game->runs.push(run);
+    game->selected_run = game->runs.len - 1;
+    ok = true;
+    return true;
+}
+
+static bool read_index(Session* session, Run_Info* run, uint64_t file_size) {
+    if (file_size < session_header_size + record_header_size + index_trailer_size)
+        return false;
+
+    char trailer[index_trailer_size];
+    uint64_t trailer_offset = file_size - index_trailer_size;
+    if (!seek_file(session->file, trailer_offset) ||
+        fread(trailer, 1, sizeof(trailer), session->file) != sizeof(trailer) ||
+        memcmp(trailer + 8, index_magic, sizeof(index_magic)) != 0) {
+        return false;
+    }
+
+    uint64_t index_offset;
+    memcpy(&index_offset, trailer, sizeof(index_offset));
+    if (index_offset < session_header_size ||
+        index_offset > trailer_offset - record_header_size) {
+        return false;
+    }
+
+    cz::String* index = &session->index;
+    size_t size = (size_t)(trailer_offset - index_offset);
+    if (!read_at(session->file, index_offset, size, index) || index->buffer[0] != RECORD_INDEX)
+        return false;
+
+    Reader reader = {index->buffer, index->len, record_header_size, true};
+    uint64_t num_strokes = take_value<uint64_t>(&reader);
+    uint64_t num_colors = take_value<uint64_t>(&reader);
+    if (num_colors > max_palette_size || (index->len - reader.pos) / index_entry_size < num_strokes)
+        return false;
+    take_vector(&reader, &run->palette, (size_t)num_colors);
+
+    run->strokes.reserve_exact(cz::heap_allocator(), (size_t)num_strokes);
+    session->offsets.reserve_exact(cz::heap_allocator(), (size_t)num_strokes + 1);
+    for (size_t i = 0; i < num_strokes; ++i) {
+        Stroke stroke = {};
+        session->offsets.push(take_value<uint64_t>(&reader));
+        stroke.bounds = take_value<Bounds>(&reader);
+        stroke.title.len = take_value<uint32_t>(&reader);
+        run->strokes.push(stroke);
+    }
+    session->offsets.push(index_offset);
+
+    // The titles are after the fixed size entries.
+    for (size_t i = 0; i < num_strokes; ++i) {
+        run->strokes[i].title = take_str(&reader, run->strokes[i].title.len);
+    }
+
+    // Strokes must be in order for their records to end where the next one starts.
+    for (size_t i = 0; i < num_strokes; ++i) {
+        if (session->offsets[i] < session_header_size ||
+            session->offsets[i] >= session->offsets[i + 1]) {
+            reader.ok = false;
+        }
+    }
+    return reader.ok;
+}
+
+static bool scan_records(Session* session, Run_Info* run, uint64_t file_size) {
+    run->strokes.len = 0;
+    run->palette.len = 0;
+    session->offsets.len = 0;
+    session->index.len = 0;
+
+    // Titles are stored in the index buffer which moves as it grows so fix them up after.
+    cz::Vector<size_t> title_starts = {};
+    CZ_DEFER(title_starts.drop(cz::heap_allocator()));
+
+    cz::String buffer = {};
+    CZ_DEFER(buffer.drop(cz::heap_allocator()));
+
+    uint64_t offset = session_header_size;
+    while (file_size - offset >= record_header_size) {
+        if (!read_at(session->file, offset, record_header_size, &buffer))
+            break;
+        uint8_t type = (uint8_t)buffer[0];
+        uint64_t size;
+        memcpy(&size, buffer.buffer + 1, sizeof(size));
+
+        // The last record may have been cut off by a crash.
+        if (size > file_size - offset - record_header_size)
+            break;
+
+        uint64_t payload = offset + record_header_size;
+        if (type == RECORD_COLORS) {
+            size_t count = (size_t)size / sizeof(Color_Pair);
+            if (run->palette.len + count > max_palette_size)
+                break;
+            if (!read_at(session->file, payload, count * sizeof(Color_Pair), &buffer))
+                break;
+            cz::Slice<const Color_Pair> colors = {(const Color_Pair*)buffer.buffer, count};
+            run->palette.reserve(cz::heap_allocator(), count);
+            run->palette.append(colors);
+        } else if (type == RECORD_STROKE) {
+            if (size < stroke_prefix_size ||
+                !read_at(session->file, payload, stroke_prefix_size, &buffer)) {
+                break;
+            }
+            Reader reader = {buffer.buffer, buffer.len, 0, true};
+            Stroke stroke = {};
+            stroke.bounds = take_value<Bounds>(&reader);
+            stroke.title.len = take_value<uint32_t>(&reader);
+            if (stroke.title.len > size - stroke_prefix_size ||
+                !read_at(session->file, payload + stroke_prefix_size, stroke.title.len,
+                         &buffer)) {
+                break;
+            }
+
+            title_starts.reserve(cz::heap_allocator(), 1);
+            title_starts.push(session->index.len);
+            put(&session->index, buffer.buffer, buffer.len);
+            run->strokes.reserve(cz::heap_allocator(), 1);
+            run->strokes.push(stroke);
+            session->offsets.reserve(cz::heap_allocator(), 1);
+            session->offsets.push(offset);
+        } else {
+            // An index without a trailer.  The index is always last.
+            break;
+        }
+
+        offset = payload + size;
+    }
+
+    session->offsets.reserve(cz::heap_allocator(), 1);
+    session->offsets.push(offset);
+
+    for (size_t i = 0; i < run->strokes.len; ++i) {
+        run->strokes[i].title.buffer = session->index.buffer + title_starts[i];
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - mapping
+///////////////////////////////////////////////////////////////////////////////
+
+/// Map the first `size` bytes of the file, replacing the old mapping.
+static bool map_session(Session* session, uint64_t size) {
+    unmap_session(session);
+    if (size == 0)
+        return false;
+
+#ifdef _WIN32
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(session->worker_file));
+    HANDLE handle =
+        CreateFileMappingA(file, NULL, PAGE_READONLY, (DWORD)(size >> 32), (DWORD)size, NULL);
+    if (!handle)
+        return false;
+    void* memory = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    if (!memory) {
+        CloseHandle(handle);
+        return false;
+    }
+    session->mapping_handle = handle;
+#else
+    void* memory =
+        mmap(nullptr, (size_t)size, PROT_READ, MAP_SHARED, fileno(session->worker_file), 0);
+    if (memory == MAP_FAILED)
+        return false;
+#endif
+
+    session->mapping = (const char*)memory;
+    session->mapping_size = size;
+    return true;
+}
+
+static void unmap_session(Session* session) {
+    if (!session->mapping)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(session->mapping);
+    CloseHandle(session->mapping_handle);
+#else
+    munmap((void*)session->mapping, (size_t)session->mapping_size);
+#endif
+    session->mapping = nullptr;
+    session->mapping_size = 0;
+}
+
+/// Strokes are copied out of the mapping so the pages that
+/// were read don't have to count towards the process's memory.
+static void release_pages(const Session* session, uint64_t start, uint64_t end) {
+#ifndef _WIN32
+    uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    start -= start % page_size;
+    madvise((void*)(session->mapping + start), (size_t)(end - start), MADV_DONTNEED);
+#else
+    (void)session, (void)start, (void)end;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - loading strokes
+///////////////////////////////////////////////////////////////////////////////
+
+void load_stroke(Run_Info* run, size_t index) {
+    Session* session = run->session;
+    // Strokes that aren't stored yet are only in memory.
+    if (!session || index >= session->resident.len)
+        return;
+
+    session->last_used[index] = current_frame;
+    if (session->resident[index])
+        return;
+
+    ZoneScoped;
+
+    uint64_t start = session->offsets[index];
+    uint64_t end = session->offsets[index + 1];
+    // The file grows while recording so map the strokes stored since it was last mapped.
+    if (end > session->mapping_size)
+        map_session(session, session->offsets.last());
+
+    // Don't try again if reading fails.  The stroke is left empty.
+    Stroke* stroke = &run->strokes[index];
+    bool ok = false;
+    if (end <= session->mapping_size) {
+        cz::Str record = {session->mapping + start, (size_t)(end - start)};
+        ok = parse_stroke(record, run->palette.len, stroke);
+        release_pages(session, start, end);
+    }
+    if (!ok)
+        fprintf(stderr, "Failed to read stroke %zu of %s\n", index, session->path.buffer);
+
+    session->resident[index] = true;
+    session->resident_memory += stroke_memory(stroke);
+}
+
+bool read_stroke(FILE* file, uint64_t start, uint64_t end, size_t num_colors, Stroke* stroke) {
+    cz::String buffer = {};
+    CZ_DEFER(buffer.drop(cz::heap_allocator()));
+    if (!read_at(file, start, (size_t)(end - start), &buffer)) {
+        parse_stroke({}, num_colors, stroke);
+        return false;
+    }
+    return parse_stroke(buffer, num_colors, stroke);
+}
+
+/// Parse a stroke record.  The title and bounds are already known from the index.
+static bool parse_stroke(cz::Str record, size_t num_colors, Stroke* stroke) {
+    bool ok = false;
+    if (record.len > 0 && record[0] == RECORD_STROKE) {
+        Reader reader = {record.buffer, record.len, record_header_size, true};
+        take_value<Bounds>(&reader);
+        take_str(&reader, take_value<uint32_t>(&reader));
+
+        uint32_t counts[5];
+        take(&reader, counts, sizeof(counts));
+        take_vector(&reader, &stroke->segments, counts[0]);
+        take_vector(&reader, &stroke->chunks, counts[1]);
+        take_vector(&reader, &stroke->blocks, counts[2]);
+
+        cz::Str data = take_str(&reader, counts[3]);
+        stroke->data.len = 0;
+        stroke->data.reserve_exact(cz::heap_allocator(), data.len);
+        stroke->data.append(data);
+
+        take_vector(&reader, &stroke->cell_dxs, counts[4]);
+        take_vector(&reader, &stroke->cell_dys, counts[4]);
+        take_vector(&reader, &stroke->cell_colors, counts[4]);
+        take_vector(&reader, &stroke->cell_chars, counts[4]);
+
+        ok = reader.ok && valid_stroke(stroke, num_colors);
+    }
+
+    if (!ok) {
+        // Leave the stroke empty instead of half read.
+        cz::Str title = stroke->title;
+        Bounds bounds = stroke->bounds;
+        drop_stroke(stroke);
+        *stroke = {};
+        stroke->title = title;
+        stroke->bounds = bounds;
+    }
+    return ok;
+}
+
+/// Check every index in the stroke so a corrupt file can't make us read out of bounds.
+static bool valid_stroke(const Stroke* stroke, size_t num_colors) {
+    for (size_t i = 0; i < stroke->segments.len; ++i) {
+        const Segment& segment = stroke->segments[i];
+        if (segment.type == SEGMENT_CHUNK) {
+            if (segment.index >= stroke->chunks.len)
+                return false;
+        } else if (segment.type == SEGMENT_BLOCK) {
+            if (segment.index >= stroke->blocks.len)
+                return false;
+        } else {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < stroke->chunks.len; ++i) {
+        const Chunk& chunk = stroke->chunks[i];
+        if (chunk.start > chunk.end || chunk.end > stroke->cell_chars.len)
+            return false;
+    }
+
+    for (size_t i = 0; i < stroke->blocks.len; ++i) {
+        const Block& block = stroke->blocks[i];
+        uint64_t cells = (uint64_t)block.width * block.height;
+        if (block.chars > stroke->data.len || cells > stroke->data.len - block.chars)
+            return false;
+        if ((block.flags & BLOCK_HAS_FG) &&
+            (block.fgs > stroke->data.len || cells * 3 > stroke->data.len - block.fgs)) {
+            return false;
+        }
+        if ((block.flags & BLOCK_HAS_BG) &&
+            (block.bgs > stroke->data.len || cells * 3 > stroke->data.len - block.bgs)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < stroke->cell_colors.len; ++i) {
+        if (stroke->cell_colors[i] >= num_colors)
+            return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - eviction
+///////////////////////////////////////////////////////////////////////////////
+
+static size_t stroke_memory(const Stroke* stroke) {
+    return stroke->segments.cap * sizeof(Segment) + stroke->chunks.cap * sizeof(Chunk) +
+           stroke->blocks.cap * sizeof(Block) + stroke->data.cap +
+           stroke->cell_dxs.cap * sizeof(stroke->cell_dxs[0]) +
+           stroke->cell_dys.cap * sizeof(stroke->cell_dys[0]) +
+           stroke->cell_colors.cap * sizeof(stroke->cell_colors[0]) +
+           stroke->cell_chars.cap * sizeof(stroke->cell_chars[0]);
+}
+
+/// Drop the draw commands of a stored stroke.  They are read back by `load_stroke`.
+static void evict_stroke(Session* session, Stroke* stroke, size_t index) {
+    session->resident_memory -= stroke_memory(stroke);
+    session->resident[index] = false;
+
+    cz::Str title = stroke->title;
+    Bounds bounds = stroke->bounds;
+    drop_stroke(stroke);
+    *stroke = {};
+    stroke->title = title;
+    stroke->bounds = bounds;
+}
+
+void trim_sessions(Game_State* game, size_t memory_budget) {
+    ZoneScoped;
+
+    // Strokes that aren't stored in a session file yet can't be evicted
+    // but they still count against the budget.
+    size_t memory = 0;
+    for (size_t r = 0; r < game->runs.len; ++r) {
+        const Run_Info* run = &game->runs[r];
+        size_t stored = 0;
+        if (run->session) {
+            memory += run->session->resident_memory;
+            stored = run->session->resident.len;
+        }
+        for (size_t i = stored; i < run->strokes.len; ++i)
+            memory += stroke_memory(&run->strokes[i]);
+    }
+
+    if (memory > memory_budget) {
+        // Go under the budget so strokes aren't evicted every frame.
+        size_t target = memory_budget / 4 * 3;
+
+        uint64_t oldest = current_frame;
+        for (size_t r = 0; r < game->runs.len; ++r) {
+            const Session* session = game->runs[r].session;
+            for (size_t i = 0; session && i < session->resident.len; ++i) {
+                if (session->resident[i])
+                    oldest = cz::min(oldest, session->last_used[i]);
+            }
+        }
+
+        // Evict strokes that haven't been used for `age` frames, halving the age until
+        // enough memory is freed.  This is close enough to least recently used without
+        // having to sort.  Strokes used this frame are never evicted.
+        for (uint64_t age = current_frame - oldest; age > 0 && memory > target; age /= 2) {
+            for (size_t r = 0; r < game->runs.len && memory > target; ++r) {
+                Run_Info* run = &game->runs[r];
+                Session* session = run->session;
+                if (!session)
+                    continue;
+
+                // The keyframe worker has shallow copies of the strokes in its job.
+                size_t busy_start = run->keyframe_end;
+                if (run->keyframe_pending)
+                    busy_start = (run->keyframes.len > 0 ? run->keyframes.last()->stroke : 0);
+
+                for (size_t i = 0; i < session->resident.len && memory > target; ++i) {
+                    if (!session->resident[i] || current_frame - session->last_used[i] < age)
+                        continue;
+                    if (i >= busy_start && i < run->keyframe_end)
+                        continue;
+                    size_t before = session->resident_memory;
+                    evict_stroke(session, &run->strokes[i], i);
+                    memory -= before - session->resident_memory;
+                }
+            }
+        }
+    }
+
+    TracyPlot("Session memory", (int64_t)memory);
+    ++current_frame;
+}
+
+}
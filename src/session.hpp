@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <cz/string.hpp>
+#include <cz/vector.hpp>
+
+#include "event.hpp"
+
+namespace gridviz {
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/// A run stored on disk.  The file starts with a header followed by a record for each
+/// stroke once it is completed and a record for the colors added before it.  When the
+/// run is finished an index of the offset, title and bounds of every stroke is appended
+/// so opening the file only has to read the index.  Files without an index (because
+/// gridviz crashed) are opened by skipping over the records instead.
+///
+/// The file is also the backing store of the run.  Once a stroke is stored its draw
+/// commands can be evicted from memory and are read back from a mapping of the file.
+struct Session {
+    FILE* file;
+    cz::String path;
+
+    /// The session was opened from a file instead of being recorded.
+    bool reading;
+
+    /// `offsets[i]` is the position of the record of stroke `i`.  The last element
+    /// is the end of the last record so there is one more element than stored strokes.
+    cz::Vector<uint64_t> offsets;
+
+    /// Has an element for every stored stroke.  Strokes that aren't resident only have
+    /// their title and bounds in memory.  Strokes that aren't stored yet are always resident.
+    cz::Vector<bool> resident;
+    /// The frame each stored stroke was last used in.
+    cz::Vector<uint64_t> last_used;
+    /// Bytes held by resident stored strokes.
+    size_t resident_memory;
+
+    /// A read only view of the first `mapping_size` bytes of the file.
+    const char* mapping;
+    uint64_t mapping_size;
+#ifdef _WIN32
+    void* mapping_handle;
+#endif
+
+    /// Writing: the number of colors in the palette that have been written.
+    size_t colors_written;
+    /// Writing: the size of the file.
+    uint64_t end;
+
+    /// Reading: the index.  Stroke titles point into it.
+    cz::String index;
+
+    /// A separate handle for the keyframe worker so it doesn't have to lock.
+    FILE* worker_file;
+};
+
+/// Stored strokes are evicted to stay under this many bytes.
+const size_t default_session_memory_budget = (size_t)512 << 20;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function Declarations
+///////////////////////////////////////////////////////////////////////////////
+
+/// Start recording new runs to `directory` and write the strokes
+/// that were completed since the last call.  Call after polling the network.
+void record_sessions(Game_State* game, cz::Str directory);
+
+/// Write the last stroke and the index of every run being recorded.
+void finish_sessions(Game_State* game);
+
+/// Add the session at `path` as a new run and select it.
+bool open_session(Game_State* game, const char* path);
+
+/// Make sure the draw commands of a stroke are in memory.  Strokes of opened sessions
+/// and strokes that were evicted are read from the file.  Call before applying the stroke.
+void load_stroke(Run_Info* run, size_t index);
+
+/// Call at the end of each frame.  Evicts the least recently used stored strokes until
+/// the draw commands of all strokes fit in the memory budget.  Strokes that aren't
+/// stored in a session file count against the budget but are never evicted.
+void trim_sessions(Game_State* game, size_t memory_budget);
+
+/// Read the stroke whose record is at `[start, end)` into `stroke`.  Doesn't touch
+/// the session so it is safe to call from any thread with its own file handle.
+bool read_stroke(FILE* file, uint64_t start, uint64_t end, size_t num_colors, Stroke* stroke);
+
+void drop_session(Session* session);
+
+}
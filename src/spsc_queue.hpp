@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+namespace gridviz {
+
+/// A fixed size lock free queue that can be pushed to by one thread and popped from by another.
+template <class T, size_t capacity>
+struct Spsc_Queue {
+    T elems[capacity];
+
+    /// Both indices increase forever and are taken modulo `capacity` to get the slot.
+    std::atomic<size_t> head;  // Index of the next element to pop.  Written by the consumer.
+    std::atomic<size_t> tail;  // Index of the next element to push.  Written by the producer.
+
+    /// Push an element.  Returns `false` if the queue is full.
+    bool push(T elem) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == capacity)
+            return false;
+
+        elems[t % capacity] = elem;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Pop an element.  Returns `false` if the queue is empty.
+    bool pop(T* elem) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        *elem = elems[h % capacity];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Check if there is anything to pop.  Only exact if the producer isn't pushing.
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+}
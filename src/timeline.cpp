@@ -0,0 +1,134 @@
+#include "timeline.hpp"
+
+#include <stdint.h>
+#include <Tracy.hpp>
+#include <cz/heap.hpp>
+#include <cz/util.hpp>
+
+namespace gridviz {
+
+/// Characters before the title of every stroke.
+static const size_t timeline_prefix_length = 2;
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - layout
+///////////////////////////////////////////////////////////////////////////////
+
+void drop_timeline(Timeline* timeline) {
+    timeline->line_starts.drop(cz::heap_allocator());
+}
+
+uint64_t timeline_entry_lines(const Stroke* stroke, int columns) {
+    size_t length = timeline_prefix_length + stroke->title.len;
+    return cz::max((length + columns - 1) / columns, (size_t)1);
+}
+
+Timeline* update_timeline(Run_Info* run, int columns) {
+    if (!run->timeline) {
+        run->timeline = cz::heap_allocator().alloc<Timeline>();
+        *run->timeline = {};
+        run->timeline->scrolled_to = SIZE_MAX;
+    }
+
+    Timeline* timeline = run->timeline;
+    columns = cz::max(columns, 1);
+    if (timeline->columns != columns) {
+        // Resizing changes where every title wraps.
+        timeline->columns = columns;
+        timeline->line_starts.len = 0;
+    }
+
+    if (timeline->line_starts.len == 0) {
+        timeline->line_starts.reserve(cz::heap_allocator(), 1);
+        timeline->line_starts.push(0);
+    }
+
+    size_t start = timeline->line_starts.len - 1;
+    if (start == run->strokes.len)
+        return timeline;
+
+    ZoneScoped;
+
+    // Titles never change so only new strokes have to be laid out.
+    timeline->line_starts.reserve(cz::heap_allocator(), run->strokes.len - start);
+    for (size_t i = start; i < run->strokes.len; ++i) {
+        uint64_t lines = timeline_entry_lines(&run->strokes[i], columns);
+        timeline->line_starts.push(timeline->line_starts.last() + lines);
+    }
+    return timeline;
+}
+
+int64_t timeline_entry_top(const Timeline* timeline, size_t index) {
+    return (int64_t)timeline->line_starts[index] * timeline->line_height +
+           (int64_t)index * timeline_entry_spacing;
+}
+
+int64_t timeline_height(const Timeline* timeline) {
+    return timeline_entry_top(timeline, timeline->line_starts.len - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - scrolling
+///////////////////////////////////////////////////////////////////////////////
+
+size_t find_timeline_entry(const Timeline* timeline, int64_t y) {
+    // Entries are sorted by their tops so binary search for the last one starting above `y`.
+    size_t count = timeline->line_starts.len - 1;
+    size_t start = 0;
+    size_t end = count;
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (timeline_entry_top(timeline, mid + 1) <= y) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return start;
+}
+
+bool find_stroke_at(const Timeline* timeline, int y, size_t* index) {
+    size_t count = timeline->line_starts.len - 1;
+    if (count == 0)
+        return false;
+
+    // If flick up or down fast then recognize that.
+    if (y < timeline->view_top) {
+        size_t first = find_timeline_entry(timeline, timeline->scroll);
+        *index = (first > 0 ? first - 1 : 0);
+        return true;
+    }
+    if (y >= timeline->view_top + timeline->view_height) {
+        int64_t bottom = timeline->scroll + timeline->view_height - 1;
+        size_t last = find_timeline_entry(timeline, bottom);
+        *index = cz::min(last + 1, count);
+        return true;
+    }
+
+    // Entries are highlighted from 2 pixels above their text to the divider below it.
+    int64_t list_y = y - timeline->view_top + timeline->scroll + 2;
+    *index = find_timeline_entry(timeline, list_y);
+    return true;
+}
+
+void scroll_to_entry(Timeline* timeline, size_t index) {
+    size_t count = timeline->line_starts.len - 1;
+    if (count == 0)
+        return;
+    index = cz::min(index, count - 1);
+
+    int64_t top = timeline_entry_top(timeline, index);
+    int64_t bottom = timeline_entry_top(timeline, index + 1);
+    if (bottom > timeline->scroll + timeline->view_height)
+        timeline->scroll = bottom - timeline->view_height;
+    // Show the start of entries taller than the view.
+    if (top < timeline->scroll)
+        timeline->scroll = top;
+}
+
+void clamp_timeline_scroll(Timeline* timeline) {
+    int64_t max_scroll = cz::max(timeline_height(timeline) - timeline->view_height, (int64_t)0);
+    timeline->scroll = cz::max(cz::min(timeline->scroll, max_scroll), (int64_t)0);
+}
+
+}
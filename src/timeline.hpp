@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cz/vector.hpp>
+
+#include "event.hpp"
+
+namespace gridviz {
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+/// Pixels between the text of two strokes.  Padding, a divider and more padding.
+const int timeline_entry_spacing = 5;
+
+/// The layout of a run's stroke list.  Only the strokes in view are drawn.
+struct Timeline {
+    /// `line_starts[i]` is the number of wrapped lines before stroke `i`.
+    /// Has one more element than the number of strokes laid out.
+    cz::Vector<uint64_t> line_starts;
+    /// Characters per line.  The layout is redone when this changes.
+    int columns;
+
+    /// Pixels scrolled past the top of the list.
+    int64_t scroll;
+    /// Height of a line of text, the window position of the top of the
+    /// list and its height in pixels the last time it was drawn.
+    int line_height;
+    int view_top;
+    int64_t view_height;
+
+    /// The selected stroke that was last scrolled into view.  The list only
+    /// follows the selection when it changes so it can be scrolled away from.
+    size_t scrolled_to;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Function Declarations
+///////////////////////////////////////////////////////////////////////////////
+
+/// Lay out the strokes that were added since the last call.  Everything is
+/// laid out again if `columns` changed.  Creates the timeline if needed.
+Timeline* update_timeline(Run_Info* run, int columns);
+
+/// Number of lines stroke titles wrap to including the `"+ "` prefix.
+uint64_t timeline_entry_lines(const Stroke* stroke, int columns);
+
+/// Position of the top of the stroke's text relative to the top of the list.
+int64_t timeline_entry_top(const Timeline* timeline, size_t index);
+/// Height of the entire list in pixels.
+int64_t timeline_height(const Timeline* timeline);
+
+/// Find the first stroke whose entry ends below `y`.  Returns the number
+/// of strokes if `y` is below the list.  `y` is relative to the top of the list.
+size_t find_timeline_entry(const Timeline* timeline, int64_t y);
+
+/// Find the stroke under the window position `y`.  Positions above or below the
+/// list give the stroke just outside the view so dragging past the edges scrolls.
+bool find_stroke_at(const Timeline* timeline, int y, size_t* index);
+
+/// Scroll the minimum amount so the stroke is entirely visible.
+void scroll_to_entry(Timeline* timeline, size_t index);
+/// Keep the scroll position inside the list.
+void clamp_timeline_scroll(Timeline* timeline);
+
+void drop_timeline(Timeline* timeline);
+
+}
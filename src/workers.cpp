@@ -0,0 +1,158 @@
+#include "workers.hpp"
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <Tracy.hpp>
+#include <cz/heap.hpp>
+
+namespace gridviz {
+
+static void worker_main(Worker_Pool* pool);
+
+///////////////////////////////////////////////////////////////////////////////
+// Type Definitions
+///////////////////////////////////////////////////////////////////////////////
+
+struct Worker_Pool {
+    std::thread* threads;
+    size_t num_threads;
+
+    std::mutex mutex;
+    /// Signaled when a job is started or the pool is stopped.
+    std::condition_variable start;
+    /// Signaled when a worker stops working on the job.
+    std::condition_variable done;
+    bool stop;
+
+    /// Incremented for every job.  Guarded by `mutex`.
+    uint64_t generation;
+    /// Workers that are running the current job.  Guarded by `mutex`.
+    size_t active;
+
+    /// The current job.  Only written while no workers are active.
+    Worker_Func func;
+    void* data;
+    size_t count;
+
+    /// The next index to run.
+    std::atomic<size_t> next;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - lifetime
+///////////////////////////////////////////////////////////////////////////////
+
+size_t default_worker_count() {
+    unsigned processors = std::thread::hardware_concurrency();
+    return (processors > 1 ? processors - 1 : 0);
+}
+
+Worker_Pool* start_workers(size_t count) {
+    Worker_Pool* pool = cz::heap_allocator().alloc<Worker_Pool>();
+    new (pool) Worker_Pool();
+    pool->next = 0;
+
+    pool->num_threads = count;
+    pool->threads = (count > 0 ? cz::heap_allocator().alloc<std::thread>(count) : nullptr);
+    for (size_t i = 0; i < count; ++i) {
+        new (&pool->threads[i]) std::thread(worker_main, pool);
+    }
+    return pool;
+}
+
+void stop_workers(Worker_Pool* pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stop = true;
+    }
+    pool->start.notify_all();
+
+    for (size_t i = 0; i < pool->num_threads; ++i) {
+        pool->threads[i].join();
+        pool->threads[i].~thread();
+    }
+    if (pool->threads)
+        cz::heap_allocator().dealloc(pool->threads, pool->num_threads);
+
+    pool->~Worker_Pool();
+    cz::heap_allocator().dealloc(pool);
+}
+
+size_t worker_count(const Worker_Pool* pool) {
+    return pool->num_threads + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Module Code - running jobs
+///////////////////////////////////////////////////////////////////////////////
+
+static void run_indices(Worker_Pool* pool) {
+    while (1) {
+        size_t index = pool->next.fetch_add(1);
+        if (index >= pool->count)
+            break;
+        pool->func(pool->data, index);
+    }
+}
+
+void run_parallel(Worker_Pool* pool, size_t count, Worker_Func func, void* data) {
+    ZoneScoped;
+
+    if (count == 0)
+        return;
+
+    // Not worth waking up the workers.
+    if (pool->num_threads == 0 || count == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            func(data, i);
+        }
+        return;
+    }
+
+    {
+        // Workers that woke up late for the previous job may still be reading it.
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        pool->done.wait(lock, [&]() { return pool->active == 0; });
+        pool->func = func;
+        pool->data = data;
+        pool->count = count;
+        pool->next = 0;
+        ++pool->generation;
+    }
+    pool->start.notify_all();
+
+    run_indices(pool);
+
+    // Every index has been claimed.  Wait for the workers running the last ones.
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done.wait(lock, [&]() { return pool->active == 0; });
+}
+
+static void worker_main(Worker_Pool* pool) {
+    uint64_t generation = 0;
+    while (1) {
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->start.wait(lock, [&]() { return pool->stop || pool->generation != generation; });
+            if (pool->stop)
+                return;
+            generation = pool->generation;
+            ++pool->active;
+        }
+
+        // If we woke up late then every index has been claimed and this returns immediately.
+        run_indices(pool);
+
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            --pool->active;
+        }
+        pool->done.notify_one();
+    }
+}
+
+}
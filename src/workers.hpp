@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace gridviz {
+
+struct Worker_Pool;
+
+typedef void (*Worker_Func)(void* data, size_t index);
+
+/// Start `count` worker threads.  A pool with no threads runs everything on the calling thread.
+Worker_Pool* start_workers(size_t count);
+void stop_workers(Worker_Pool* pool);
+
+/// One worker per processor other than the one the calling thread runs on.
+size_t default_worker_count();
+
+/// Number of threads that run jobs including the calling thread.
+size_t worker_count(const Worker_Pool* pool);
+
+/// Call `func(data, index)` for every index in `[0, count)`.  The calling thread
+/// helps and returns once every call has finished.  Only call from one thread.
+void run_parallel(Worker_Pool* pool, size_t count, Worker_Func func, void* data);
+
+template <class Callback>
+void run_parallel(Worker_Pool* pool, size_t count, Callback&& callback) {
+    struct Wrapper {
+        static void call(void* data, size_t index) { (*(Callback*)data)(index); }
+    };
+    run_parallel(pool, count, Wrapper::call, (void*)&callback);
+}
+
+}
@@ -0,0 +1,299 @@
+#include <czt/test_base.hpp>
+
+#include <stdint.h>
+#include <string.h>
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+
+#define NETGRIDVIZ_DEFINE_PROTOCOL
+#include "../netgridviz.h"
+
+#include "protocol.hpp"
+
+using namespace gridviz;
+
+static size_t encode_varint(uint64_t value, char* out) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (char)value;
+    return len;
+}
+
+static uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+TEST_CASE("read_varint round trips") {
+    uint64_t values[] = {0, 1, 127, 128, 300, 16383, 16384, UINT32_MAX, UINT64_MAX};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        char buffer[16];
+        size_t len = encode_varint(values[i], buffer);
+        size_t index = 0;
+        uint64_t value = 0;
+        CHECK(read_varint({buffer, len}, &index, &value) == VARINT_OK);
+        CHECK(index == len);
+        CHECK(value == values[i]);
+    }
+}
+
+TEST_CASE("read_varint reads from the index") {
+    char buffer[] = {'x', (char)0xac, 0x02, 'y'};
+    size_t index = 1;
+    uint64_t value = 0;
+    CHECK(read_varint({buffer, sizeof(buffer)}, &index, &value) == VARINT_OK);
+    CHECK(index == 3);
+    CHECK(value == 300);
+}
+
+TEST_CASE("read_varint incomplete") {
+    char buffer[] = {(char)0xff, (char)0xff};
+    size_t index = 0;
+    uint64_t value = 0;
+    CHECK(read_varint({buffer, 0}, &index, &value) == VARINT_INCOMPLETE);
+    index = 0;
+    CHECK(read_varint({buffer, sizeof(buffer)}, &index, &value) == VARINT_INCOMPLETE);
+}
+
+TEST_CASE("read_varint longer than 10 bytes is invalid") {
+    char buffer[11];
+    memset(buffer, 0x80, sizeof(buffer));
+    buffer[10] = 0x01;
+    size_t index = 0;
+    uint64_t value = 0;
+    CHECK(read_varint({buffer, sizeof(buffer)}, &index, &value) == VARINT_INVALID);
+
+    // Invalid even if the buffer ends right after the tenth byte.
+    index = 0;
+    CHECK(read_varint({buffer, 10}, &index, &value) == VARINT_INVALID);
+}
+
+TEST_CASE("zigzag_decode round trips") {
+    CHECK(zigzag_decode(0) == 0);
+    CHECK(zigzag_decode(1) == -1);
+    CHECK(zigzag_decode(2) == 1);
+    CHECK(zigzag_decode(3) == -2);
+
+    int64_t values[] = {0, 1, -1, 63, -64, 1000000, -1000000000000LL, INT64_MAX, INT64_MIN};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        CHECK(zigzag_decode(zigzag_encode(values[i])) == values[i]);
+    }
+}
+
+static void put_u32(cz::String* message, size_t offset, uint32_t value) {
+    memcpy(message->buffer + offset, &value, sizeof(value));
+}
+
+static cz::String make_message(uint8_t type, size_t len) {
+    cz::String message = {};
+    message.reserve_exact(cz::heap_allocator(), len);
+    message.len = len;
+    memset(message.buffer, 0, len);
+    message.buffer[0] = (char)type;
+    return message;
+}
+
+TEST_CASE("get_event_length fixed size messages") {
+    uint8_t types[] = {GRIDVIZ_SET_FG, GRIDVIZ_SET_BG, GRIDVIZ_SEND_CHAR, GRIDVIZ_HELLO};
+    size_t lengths[] = {6, 6, 20, 5};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+        cz::String message = make_message(types[i], lengths[i]);
+        CZ_DEFER(message.drop(cz::heap_allocator()));
+        for (size_t len = 1; len <= message.len; ++len) {
+            CHECK(get_event_length(types[i], message.slice_end(len)) == lengths[i]);
+        }
+    }
+}
+
+TEST_CASE("get_event_length start stroke") {
+    cz::String message = make_message(GRIDVIZ_START_STROKE, 5 + 3);
+    CZ_DEFER(message.drop(cz::heap_allocator()));
+    put_u32(&message, 1, 3);
+
+    // The title length isn't known until the header is complete.
+    for (size_t len = 1; len < 5; ++len) {
+        CHECK(get_event_length(GRIDVIZ_START_STROKE, message.slice_end(len)) == 5);
+    }
+    for (size_t len = 5; len <= message.len; ++len) {
+        CHECK(get_event_length(GRIDVIZ_START_STROKE, message.slice_end(len)) == 8);
+    }
+}
+
+TEST_CASE("get_event_length send string") {
+    cz::String message = make_message(GRIDVIZ_SEND_STRING, 23 + 4);
+    CZ_DEFER(message.drop(cz::heap_allocator()));
+    put_u32(&message, 19, 4);
+
+    for (size_t len = 1; len < 23; ++len) {
+        CHECK(get_event_length(GRIDVIZ_SEND_STRING, message.slice_end(len)) == 23);
+    }
+    for (size_t len = 23; len <= message.len; ++len) {
+        CHECK(get_event_length(GRIDVIZ_SEND_STRING, message.slice_end(len)) == 27);
+    }
+}
+
+TEST_CASE("get_event_length rejects oversized titles and strings") {
+    cz::String title = make_message(GRIDVIZ_START_STROKE, 5);
+    CZ_DEFER(title.drop(cz::heap_allocator()));
+    put_u32(&title, 1, (uint32_t)max_message_payload);
+    CHECK(get_event_length(GRIDVIZ_START_STROKE, title) == 5 + max_message_payload);
+    put_u32(&title, 1, (uint32_t)max_message_payload + 1);
+    CHECK(get_event_length(GRIDVIZ_START_STROKE, title) == invalid_event_length);
+    put_u32(&title, 1, UINT32_MAX);
+    CHECK(get_event_length(GRIDVIZ_START_STROKE, title) == invalid_event_length);
+
+    cz::String string = make_message(GRIDVIZ_SEND_STRING, 23);
+    CZ_DEFER(string.drop(cz::heap_allocator()));
+    put_u32(&string, 19, (uint32_t)max_message_payload);
+    CHECK(get_event_length(GRIDVIZ_SEND_STRING, string) == 23 + max_message_payload);
+    put_u32(&string, 19, (uint32_t)max_message_payload + 1);
+    CHECK(get_event_length(GRIDVIZ_SEND_STRING, string) == invalid_event_length);
+    put_u32(&string, 19, UINT32_MAX);
+    CHECK(get_event_length(GRIDVIZ_SEND_STRING, string) == invalid_event_length);
+}
+
+TEST_CASE("get_event_length send grid") {
+    cz::String message = make_message(GRIDVIZ_SEND_GRID, 28);
+    CZ_DEFER(message.drop(cz::heap_allocator()));
+    put_u32(&message, 19, 3);
+    put_u32(&message, 23, 2);
+
+    for (size_t len = 1; len < 28; ++len) {
+        CHECK(get_event_length(GRIDVIZ_SEND_GRID, message.slice_end(len)) == 28);
+    }
+
+    // Each cell has a character and optionally a foreground and background color.
+    CHECK(get_event_length(GRIDVIZ_SEND_GRID, message) == 28 + 6);
+    message.buffer[27] = GRIDVIZ_GRID_HAS_FG;
+    CHECK(get_event_length(GRIDVIZ_SEND_GRID, message) == 28 + 6 * 4);
+    message.buffer[27] = GRIDVIZ_GRID_HAS_FG | GRIDVIZ_GRID_HAS_BG;
+    CHECK(get_event_length(GRIDVIZ_SEND_GRID, message) == 28 + 6 * 7);
+}
+
+TEST_CASE("get_event_length rejects oversized grids") {
+    cz::String message = make_message(GRIDVIZ_SEND_GRID, 28);
+    CZ_DEFER(message.drop(cz::heap_allocator()));
+
+    // Exactly at the limit.
+    put_u32(&message, 19, 1 << 15);
+    put_u32(&message, 23, 1 << 15);
+    CHECK(get_event_length(GRIDVIZ_SEND_GRID, message) == 28 + max_message_payload);
+
+    message.buffer[27] = GRIDVIZ_GRID_HAS_FG;
+    CHECK(get_event_length(GRIDVIZ_SEND_GRID, message) == invalid_event_length);
+
+    // The size overflows 64 bits if it isn't checked before scaling by the cell size.
+    put_u32(&message, 19, UINT32_MAX);
+    put_u32(&message, 23, UINT32_MAX);
+    message.buffer[27] = GRIDVIZ_GRID_HAS_FG | GRIDVIZ_GRID_HAS_BG;
+    CHECK(get_event_length(GRIDVIZ_SEND_GRID, message) == invalid_event_length);
+}
+
+TEST_CASE("get_event_length compact char") {
+    // Context id, dx and dy followed by the character.
+    uint8_t type = GRIDVIZ_COMPACT_CHAR;
+    char message[] = {(char)type, 0x05, (char)0x80, 0x01, 0x03, 'a'};
+    for (size_t len = 1; len < 5; ++len) {
+        size_t length = get_event_length(type, {message, len});
+        CHECK(length > len);
+        CHECK(length != invalid_event_length);
+    }
+    CHECK(get_event_length(type, {message, 5}) == 6);
+    CHECK(get_event_length(type, {message, sizeof(message)}) == 6);
+
+    // Flags remove the fields.
+    type = GRIDVIZ_COMPACT_CHAR | GRIDVIZ_COMPACT_SAME_CONTEXT;
+    char same_context[] = {(char)type, 0x02, 0x04, 'b'};
+    CHECK(get_event_length(type, {same_context, 1}) == 2);
+    CHECK(get_event_length(type, {same_context, sizeof(same_context)}) == 4);
+
+    type = GRIDVIZ_COMPACT_CHAR | GRIDVIZ_COMPACT_NEXT_CELL;
+    char next_cell[] = {(char)type, 0x07, 'c'};
+    CHECK(get_event_length(type, {next_cell, sizeof(next_cell)}) == 3);
+
+    type = GRIDVIZ_COMPACT_CHAR | GRIDVIZ_COMPACT_SAME_CONTEXT | GRIDVIZ_COMPACT_NEXT_CELL;
+    char only_char[] = {(char)type, 'd'};
+    CHECK(get_event_length(type, {only_char, 1}) == 2);
+    CHECK(get_event_length(type, {only_char, sizeof(only_char)}) == 2);
+}
+
+TEST_CASE("get_event_length compact char with a malformed varint") {
+    uint8_t type = GRIDVIZ_COMPACT_CHAR | GRIDVIZ_COMPACT_SAME_CONTEXT;
+    char message[16];
+    memset(message, 0xff, sizeof(message));
+    message[0] = (char)type;
+    CHECK(get_event_length(type, {message, sizeof(message)}) == invalid_event_length);
+}
+
+TEST_CASE("get_event_length unknown message types") {
+    char message[32] = {};
+    CHECK(get_event_length(0, {message, sizeof(message)}) == invalid_event_length);
+    CHECK(get_event_length(GRIDVIZ_HELLO + 1, {message, sizeof(message)}) ==
+          invalid_event_length);
+    CHECK(get_event_length(0x7f, {message, 1}) == invalid_event_length);
+}
+
+#ifdef __linux__
+/// A ring with 16 bytes of data followed by 16 bytes that aren't part of the mapping.
+struct Test_Ring {
+    gridviz_ring_header header;
+    char data[16];
+    char past_end[16];
+};
+
+TEST_CASE("open_ring_reader rejects invalid capacities") {
+    Test_Ring ring = {};
+    Ring_Reader reader;
+    size_t size = sizeof(gridviz_ring_header) + sizeof(ring.data);
+    ring.header.capacity = 0;
+    CHECK(!open_ring_reader(&reader, &ring, size));
+    ring.header.capacity = 12;
+    CHECK(!open_ring_reader(&reader, &ring, size));
+    ring.header.capacity = 32;
+    CHECK(!open_ring_reader(&reader, &ring, size));
+    CHECK(!open_ring_reader(&reader, &ring, sizeof(gridviz_ring_header) - 1));
+    ring.header.capacity = 16;
+    CHECK(open_ring_reader(&reader, &ring, size));
+}
+
+TEST_CASE("read_ring ignores changes to the header after opening") {
+    Test_Ring ring = {};
+    memset(ring.past_end, 'X', sizeof(ring.past_end));
+    ring.header.capacity = 16;
+    ring.header.head = 10;
+    ring.header.tail = 10;
+    Ring_Reader reader;
+    REQUIRE(open_ring_reader(&reader, &ring, sizeof(gridviz_ring_header) + sizeof(ring.data)));
+
+    cz::String buffer = {};
+    CZ_DEFER(buffer.drop(cz::heap_allocator()));
+
+    // Write 8 bytes wrapping around the end of the ring.
+    memcpy(ring.data + 10, "abcdef", 6);
+    memcpy(ring.data, "gh", 2);
+    ring.header.tail = 18;
+
+    // The client grows the capacity and moves the head.  Reading must still
+    // use the capacity and head from when the ring was opened.
+    ring.header.capacity = 32;
+    ring.header.head = 4;
+
+    uint64_t available;
+    REQUIRE(ring_available(&reader, &available));
+    CHECK(available == 8);
+    read_ring(&reader, &buffer, (size_t)available);
+    CHECK(buffer.as_str() == "abcdefgh");
+    CHECK(reader.head == 18);
+    CHECK(reader.capacity == 16);
+    CHECK(ring.header.head == 18);
+
+    // A tail more than the capacity past the head is rejected.
+    ring.header.tail = 18 + 17;
+    CHECK(!ring_available(&reader, &available));
+    ring.header.tail = 17;
+    CHECK(!ring_available(&reader, &available));
+}
+#endif
@@ -0,0 +1,239 @@
+#include <czt/test_base.hpp>
+
+#include <stdio.h>
+#include <string.h>
+#include <cz/defer.hpp>
+#include <cz/format.hpp>
+#include <cz/heap.hpp>
+#include <cz/string.hpp>
+
+#include "grid.hpp"
+#include "session.hpp"
+
+using namespace gridviz;
+
+/// Two cells drawn one at a time.
+static Stroke make_chunk_stroke(cz::Str title) {
+    Stroke stroke = {};
+    stroke.title = title;
+    stroke.bounds = {5, 6, 6, 6};
+
+    Chunk chunk = {5, 6, 0, 2, 0, 0, 1, 0};
+    stroke.chunks.reserve(cz::heap_allocator(), 1);
+    stroke.chunks.push(chunk);
+    stroke.segments.reserve(cz::heap_allocator(), 1);
+    stroke.segments.push({SEGMENT_CHUNK, 0});
+
+    stroke.cell_dxs.reserve(cz::heap_allocator(), 2);
+    stroke.cell_dys.reserve(cz::heap_allocator(), 2);
+    stroke.cell_colors.reserve(cz::heap_allocator(), 2);
+    stroke.cell_chars.reserve(cz::heap_allocator(), 2);
+    for (int i = 0; i < 2; ++i) {
+        stroke.cell_dxs.push((int16_t)i);
+        stroke.cell_dys.push(0);
+        stroke.cell_colors.push(0);
+        stroke.cell_chars.push((uint8_t)('a' + i));
+    }
+    return stroke;
+}
+
+/// A string drawn as a block.
+static Stroke make_block_stroke(cz::Str title, cz::Str chars) {
+    Stroke stroke = {};
+    stroke.title = title;
+    stroke.bounds = {1, 2, 1 + (int64_t)chars.len - 1, 2};
+
+    Block block = {};
+    block.x = 1;
+    block.y = 2;
+    block.width = (uint32_t)chars.len;
+    block.height = 1;
+    block.chars = 0;
+    stroke.blocks.reserve(cz::heap_allocator(), 1);
+    stroke.blocks.push(block);
+    stroke.segments.reserve(cz::heap_allocator(), 1);
+    stroke.segments.push({SEGMENT_BLOCK, 0});
+
+    stroke.data.reserve_exact(cz::heap_allocator(), chars.len);
+    stroke.data.append(chars);
+    return stroke;
+}
+
+static void drop_test_run(Run_Info* run) {
+    for (size_t i = 0; i < run->strokes.len; ++i) {
+        drop_stroke(&run->strokes[i]);
+    }
+    run->strokes.drop(cz::heap_allocator());
+    run->palette.drop(cz::heap_allocator());
+    if (run->session) {
+        drop_session(run->session);
+        cz::heap_allocator().dealloc(run->session);
+    }
+}
+
+static void drop_test_game(Game_State* game) {
+    for (size_t i = 0; i < game->runs.len; ++i) {
+        drop_test_run(&game->runs[i]);
+    }
+    game->runs.drop(cz::heap_allocator());
+}
+
+/// Record a run with three strokes to the current directory and return the path.
+static cz::String record_test_session(Game_State* game) {
+    Run_Info run = {};
+    run.start_time.year = 1999;
+    run.start_time.month = 12;
+    run.start_time.day_of_month = 31;
+    run.start_time.hour = 23;
+    run.start_time.minute = 59;
+    run.start_time.second = 58;
+
+    run.palette.reserve(cz::heap_allocator(), 1);
+    run.palette.push({{1, 2, 3}, {4, 5, 6}});
+
+    run.strokes.reserve(cz::heap_allocator(), 3);
+    run.strokes.push(make_chunk_stroke("first"));
+    run.strokes.push(make_block_stroke("second", "hello"));
+    run.strokes.push(make_block_stroke("third", "xy"));
+
+    game->runs.reserve(cz::heap_allocator(), 1);
+    game->runs.push(run);
+
+    // Everything but the last stroke is written while recording.
+    record_sessions(game, ".");
+    Session* session = game->runs.last().session;
+    CHECK(session->file != nullptr);
+    CHECK(session->resident.len == 2);
+    finish_sessions(game);
+    CHECK(session->file == nullptr);
+
+    return session->path.as_str().clone_null_terminate(cz::heap_allocator());
+}
+
+/// Copy the first `size` bytes of the file at `path` to `out`.
+static bool copy_prefix(const char* path, const char* out, size_t size) {
+    FILE* input = fopen(path, "rb");
+    if (!input)
+        return false;
+    CZ_DEFER(fclose(input));
+
+    cz::String buffer = {};
+    CZ_DEFER(buffer.drop(cz::heap_allocator()));
+    buffer.reserve_exact(cz::heap_allocator(), size);
+    buffer.len = fread(buffer.buffer, 1, size, input);
+    if (buffer.len != size)
+        return false;
+
+    FILE* output = fopen(out, "wb");
+    if (!output)
+        return false;
+    bool ok = fwrite(buffer.buffer, 1, buffer.len, output) == buffer.len;
+    return fclose(output) == 0 && ok;
+}
+
+TEST_CASE("open_session reads back a recorded session") {
+    Game_State game = {};
+    cz::String path = record_test_session(&game);
+    CZ_DEFER({
+        remove(path.buffer);
+        path.drop(cz::heap_allocator());
+    });
+    // Close the files before removing them.
+    CZ_DEFER(drop_test_game(&game));
+
+    REQUIRE(open_session(&game, path.buffer));
+    REQUIRE(game.runs.len == 2);
+    CHECK(game.selected_run == 1);
+
+    Run_Info* run = &game.runs[1];
+    CHECK(run->start_time.year == 1999);
+    CHECK(run->start_time.second == 58);
+    REQUIRE(run->palette.len == 1);
+    CHECK(run->palette[0].fg[2] == 3);
+    CHECK(run->palette[0].bg[0] == 4);
+
+    REQUIRE(run->strokes.len == 3);
+    CHECK(run->strokes[0].title == "first");
+    CHECK(run->strokes[1].title == "second");
+    CHECK(run->strokes[2].title == "third");
+    CHECK(run->strokes[1].bounds.max_x == 5);
+
+    // Strokes are only read when they are loaded.
+    CHECK(run->strokes[0].cell_chars.len == 0);
+    load_stroke(run, 0);
+    REQUIRE(run->strokes[0].cell_chars.len == 2);
+    CHECK(run->strokes[0].cell_chars[1] == 'b');
+    CHECK(run->strokes[0].cell_dxs[1] == 1);
+    REQUIRE(run->strokes[0].chunks.len == 1);
+    CHECK(run->strokes[0].chunks[0].x == 5);
+
+    load_stroke(run, 2);
+    REQUIRE(run->strokes[2].blocks.len == 1);
+    CHECK(run->strokes[2].data.as_str() == "xy");
+}
+
+TEST_CASE("open_session recovers the strokes of a truncated session") {
+    Game_State game = {};
+    cz::String path = record_test_session(&game);
+    cz::String truncated = cz::format(cz::heap_allocator(), path.as_str(), ".truncated");
+    CZ_DEFER({
+        remove(path.buffer);
+        remove(truncated.buffer);
+        path.drop(cz::heap_allocator());
+        truncated.drop(cz::heap_allocator());
+    });
+    CZ_DEFER(drop_test_game(&game));
+
+    // Cut the file off in the middle of the record of the third stroke.
+    const Session* recorded = game.runs[0].session;
+    REQUIRE(recorded->offsets.len == 4);
+    size_t size = (size_t)recorded->offsets[2] + 12;
+    REQUIRE(copy_prefix(path.buffer, truncated.buffer, size));
+
+    REQUIRE(open_session(&game, truncated.buffer));
+    REQUIRE(game.runs.len == 2);
+    Run_Info* run = &game.runs[1];
+    CHECK(run->palette.len == 1);
+    REQUIRE(run->strokes.len == 2);
+    CHECK(run->strokes[0].title == "first");
+    CHECK(run->strokes[1].title == "second");
+
+    load_stroke(run, 1);
+    CHECK(run->strokes[1].data.as_str() == "hello");
+}
+
+TEST_CASE("open_session of a session cut off before the first stroke") {
+    Game_State game = {};
+    cz::String path = record_test_session(&game);
+    cz::String truncated = cz::format(cz::heap_allocator(), path.as_str(), ".truncated");
+    CZ_DEFER({
+        remove(path.buffer);
+        remove(truncated.buffer);
+        path.drop(cz::heap_allocator());
+        truncated.drop(cz::heap_allocator());
+    });
+    CZ_DEFER(drop_test_game(&game));
+
+    // The colors are cut off too so only the header is left.
+    const Session* recorded = game.runs[0].session;
+    REQUIRE(copy_prefix(path.buffer, truncated.buffer, (size_t)recorded->offsets[0] - 9));
+
+    REQUIRE(open_session(&game, truncated.buffer));
+    REQUIRE(game.runs.len == 2);
+    CHECK(game.runs[1].strokes.len == 0);
+    CHECK(game.runs[1].palette.len == 0);
+}
+
+TEST_CASE("open_session rejects files that aren't sessions") {
+    const char* path = "gridviz-test-not-a-session.gvs";
+    FILE* file = fopen(path, "wb");
+    REQUIRE(file);
+    fputs("this is not a session file at all", file);
+    fclose(file);
+    CZ_DEFER(remove(path));
+
+    Game_State game = {};
+    CZ_DEFER(drop_test_game(&game));
+    CHECK(!open_session(&game, path));
+    CHECK(game.runs.len == 0);
+}
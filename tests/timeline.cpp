@@ -0,0 +1,114 @@
+#include <czt/test_base.hpp>
+
+#include <cz/defer.hpp>
+#include <cz/heap.hpp>
+
+#include "timeline.hpp"
+
+using namespace gridviz;
+
+/// Three strokes taking one, two and one lines.  With a line height of
+/// 10 they start at 0, 15 and 40 and the list is 55 pixels tall.
+static Timeline make_timeline() {
+    Timeline timeline = {};
+    uint64_t line_starts[] = {0, 1, 3, 4};
+    timeline.line_starts.reserve(cz::heap_allocator(), 4);
+    for (size_t i = 0; i < 4; ++i) {
+        timeline.line_starts.push(line_starts[i]);
+    }
+    timeline.line_height = 10;
+    timeline.view_top = 100;
+    timeline.view_height = 30;
+    return timeline;
+}
+
+TEST_CASE("find_timeline_entry empty list") {
+    Timeline timeline = {};
+    timeline.line_starts.reserve(cz::heap_allocator(), 1);
+    timeline.line_starts.push(0);
+    timeline.line_height = 10;
+    CZ_DEFER(drop_timeline(&timeline));
+
+    CHECK(find_timeline_entry(&timeline, -1) == 0);
+    CHECK(find_timeline_entry(&timeline, 0) == 0);
+    CHECK(find_timeline_entry(&timeline, 100) == 0);
+}
+
+TEST_CASE("find_timeline_entry edges") {
+    Timeline timeline = make_timeline();
+    CZ_DEFER(drop_timeline(&timeline));
+    REQUIRE(timeline_height(&timeline) == 55);
+
+    // Above the list.
+    CHECK(find_timeline_entry(&timeline, -100) == 0);
+    CHECK(find_timeline_entry(&timeline, 0) == 0);
+    CHECK(find_timeline_entry(&timeline, 14) == 0);
+    CHECK(find_timeline_entry(&timeline, 15) == 1);
+    CHECK(find_timeline_entry(&timeline, 39) == 1);
+    CHECK(find_timeline_entry(&timeline, 40) == 2);
+    CHECK(find_timeline_entry(&timeline, 54) == 2);
+    // Below the list.
+    CHECK(find_timeline_entry(&timeline, 55) == 3);
+    CHECK(find_timeline_entry(&timeline, 1000) == 3);
+}
+
+TEST_CASE("find_stroke_at empty list") {
+    Timeline timeline = {};
+    timeline.line_starts.reserve(cz::heap_allocator(), 1);
+    timeline.line_starts.push(0);
+    timeline.view_top = 100;
+    timeline.view_height = 30;
+    CZ_DEFER(drop_timeline(&timeline));
+
+    size_t index = 7;
+    CHECK(!find_stroke_at(&timeline, 110, &index));
+    CHECK(!find_stroke_at(&timeline, 0, &index));
+    CHECK(index == 7);
+}
+
+TEST_CASE("find_stroke_at inside the view") {
+    Timeline timeline = make_timeline();
+    CZ_DEFER(drop_timeline(&timeline));
+
+    // Entries are hit from 2 pixels above their text.
+    size_t index;
+    REQUIRE(find_stroke_at(&timeline, 100, &index));
+    CHECK(index == 0);
+    REQUIRE(find_stroke_at(&timeline, 112, &index));
+    CHECK(index == 0);
+    REQUIRE(find_stroke_at(&timeline, 113, &index));
+    CHECK(index == 1);
+    REQUIRE(find_stroke_at(&timeline, 129, &index));
+    CHECK(index == 1);
+
+    timeline.scroll = 25;
+    REQUIRE(find_stroke_at(&timeline, 100, &index));
+    CHECK(index == 1);
+    REQUIRE(find_stroke_at(&timeline, 113, &index));
+    CHECK(index == 2);
+}
+
+TEST_CASE("find_stroke_at outside the view") {
+    Timeline timeline = make_timeline();
+    CZ_DEFER(drop_timeline(&timeline));
+
+    // Above the view gives the stroke before the first visible one.
+    size_t index;
+    REQUIRE(find_stroke_at(&timeline, 99, &index));
+    CHECK(index == 0);
+    timeline.scroll = 20;
+    REQUIRE(find_stroke_at(&timeline, 0, &index));
+    CHECK(index == 0);
+    timeline.scroll = 40;
+    REQUIRE(find_stroke_at(&timeline, 0, &index));
+    CHECK(index == 1);
+
+    // Below the view gives the stroke after the last visible one.
+    timeline.scroll = 0;
+    REQUIRE(find_stroke_at(&timeline, 130, &index));
+    CHECK(index == 2);
+    // Nothing is after the last stroke so it is clamped to the number of strokes.
+    timeline.scroll = 25;
+    REQUIRE(find_stroke_at(&timeline, 1000, &index));
+    CHECK(index == 3);
+}